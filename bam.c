@@ -0,0 +1,212 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2022-2023 Jacob Morrison <jacob.morrison@vai.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <string.h>
+
+#include "bam.h"
+#include "bgzf.h"
+#include "synthbar.h"
+#include "structure.h"
+
+#define SB_BAM_UNMAPPED 4    /* FLAG of a read that is not aligned */
+#define SB_BAM_BIN      4680 /* bin of a read without a position, reg2bin(-1, 0) */
+
+// 4-bit code of each base as stored in BAM ("=ACMGRSVTWYHKDBN"), anything else is N
+static const uint8_t nt16[256] = {
+    [0 ... 255] = 15,
+    ['='] = 0,
+    ['A'] = 1, ['C'] = 2, ['M'] = 3, ['G'] = 4, ['R'] = 5, ['S'] = 6, ['V'] = 7, ['T'] = 8, ['U'] = 8, ['W'] = 9,
+    ['Y'] = 10, ['H'] = 11, ['K'] = 12, ['D'] = 13, ['B'] = 14,
+    ['a'] = 1, ['c'] = 2, ['m'] = 3, ['g'] = 4, ['r'] = 5, ['s'] = 6, ['v'] = 7, ['t'] = 8, ['u'] = 8, ['w'] = 9,
+    ['y'] = 10, ['h'] = 11, ['k'] = 12, ['d'] = 13, ['b'] = 14,
+};
+
+// Store v little-endian, returning the new end of p
+static inline uint8_t *put_u32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+
+    return p + 4;
+}
+
+// Store a Z (string) tag, returning the new end of p
+static inline uint8_t *put_tag(uint8_t *p, const char *tag, const char *s, size_t l) {
+    p[0] = (uint8_t)tag[0];
+    p[1] = (uint8_t)tag[1];
+    p[2] = 'Z';
+    memcpy(p + 3, s, l);
+    p[3 + l] = '\0';
+
+    return p + l + 4;
+}
+
+int sb_bam_header(kstring_t *out, int level) {
+    static const char text[] = "@HD\tVN:1.6\tSO:unsorted\n@PG\tID:synthbar\tPN:synthbar\tVN:" SB_VERSION "\n";
+    const uint32_t    l_text = sizeof(text) - 1;
+
+    // Magic, header text, and no reference sequences
+    uint8_t hdr[sizeof(text) + 12];
+    uint8_t *p = hdr;
+    memcpy(p, "BAM\1", 4);
+    p = put_u32(p + 4, l_text);
+    memcpy(p, text, l_text);
+    p = put_u32(p + l_text, 0);
+
+    sb_bgzf_t *z = sb_bgzf_init(level);
+    if (!z) { return -1; }
+    int ret = sb_bgzf_compress(z, out, (const char *)hdr, p - hdr);
+    sb_bgzf_destroy(z);
+
+    return ret;
+}
+
+// Store the UMI pieces of a read with extra bases beyond the fixed-length segments as a Z (string) tag, returning
+// the new end of p
+static inline uint8_t *put_umi_tag(uint8_t *p, const char *tag, const sb_structure_t *st, const char *seq,
+        size_t extra) {
+    p[0] = (uint8_t)tag[0];
+    p[1] = (uint8_t)tag[1];
+    p[2] = 'Z';
+    p    = (uint8_t *)sb_put_pieces((char *)p + 3, st->umi, st->n_umi, seq, extra);
+    *p++ = '\0';
+
+    return p;
+}
+
+// Shared body of the BAM writers, demux, pieces, and linker are compile time constants in each caller. Without
+// pieces, the UMI is at the start of the read and SEQ and QUAL run from link_start (moved along by the read's linker
+// shift with linker) to the end of it
+static inline __attribute__((always_inline)) size_t build_bam(const sb_builder_t *bd, const sb_rec_t *recs,
+        int32_t n, char *out, const int demux, const int pieces, const int linker) {
+    const sb_structure_t *st = bd->st;
+    uint8_t *p = (uint8_t *)out;
+
+    int32_t i;
+    for (i = 0; i < n; i++) {
+        const sb_rec_t *r = &recs[i];
+
+        const char *bc     = bd->barcode;
+        size_t      bc_len = bd->bc_len;
+        if ((demux || linker || bd->filter) && r->bc < 0) { continue; }
+        if (demux) {
+            bc     = bd->demux->bcs[r->bc];
+            bc_len = bd->demux->bc_lens[r->bc];
+        }
+
+        // SEQ and QUAL start after the UMI and linker
+        size_t      extra  = r->seq_l - bd->min_len;
+        size_t      start  = bd->link_start + (linker ? r->shift : 0);
+        const char *seq    = r->seq + start;
+        const char *qual   = r->qual + start;
+        size_t      l      = pieces ? st->tmpl_len + st->tmpl_grow*extra : r->seq_l - start;
+        size_t      umi    = bd->umi_len;
+        uint32_t    name_l = (uint32_t)r->name_l + 1;
+
+        // Block size, then refID, pos, l_read_name/mapq/bin, n_cigar_op/flag, l_seq, next_refID, next_pos, tlen
+        p = put_u32(p, (uint32_t)(32 + name_l + (l + 1)/2 + l + (bc_len + 4) + 2*(umi + 4)));
+        p = put_u32(p, (uint32_t)-1);
+        p = put_u32(p, (uint32_t)-1);
+        p = put_u32(p, name_l | (uint32_t)SB_BAM_BIN << 16);
+        p = put_u32(p, (uint32_t)SB_BAM_UNMAPPED << 16);
+        p = put_u32(p, (uint32_t)l);
+        p = put_u32(p, (uint32_t)-1);
+        p = put_u32(p, (uint32_t)-1);
+        p = put_u32(p, 0);
+
+        memcpy(p, r->name, r->name_l);
+        p[r->name_l] = '\0';
+        p += name_l;
+
+        size_t j;
+        if (pieces) {
+            // Template pieces can start on either half of a byte, so bases are packed one at a time
+            size_t  k = 0;
+            int32_t t;
+            for (t = 0; t < st->n_tmpl; t++) {
+                const sb_piece_t *pc = &st->tmpl[t];
+                const char       *s  = r->seq + pc->off + pc->shift*extra;
+                size_t            m  = pc->len + pc->grow*extra;
+                for (j = 0; j < m; j++, k++) {
+                    uint8_t c = nt16[(uint8_t)s[j]];
+                    if (k & 1) {
+                        p[k >> 1] |= c;
+                    } else {
+                        p[k >> 1] = (uint8_t)(c << 4);
+                    }
+                }
+            }
+            p += (l + 1)/2;
+
+            uint8_t *q = p;
+            p = (uint8_t *)sb_put_pieces((char *)p, st->tmpl, st->n_tmpl, r->qual, extra);
+            for (; q < p; q++) { *q = (uint8_t)(*q - 33); }
+
+            p = put_tag(p, "CB", bc, bc_len);
+            p = put_umi_tag(p, "UB", st, r->seq, extra);
+            p = put_umi_tag(p, "RX", st, r->seq, extra);
+            continue;
+        }
+
+        // Two bases per byte, first base in the high nibble
+        for (j = 0; j + 1 < l; j += 2) {
+            *p++ = (uint8_t)(nt16[(uint8_t)seq[j]] << 4 | nt16[(uint8_t)seq[j+1]]);
+        }
+        if (l & 1) { *p++ = (uint8_t)(nt16[(uint8_t)seq[l-1]] << 4); }
+
+        // Phred scores without the FASTQ offset
+        for (j = 0; j < l; j++) { p[j] = (uint8_t)(qual[j] - 33); }
+        p += l;
+
+        p = put_tag(p, "CB", bc, bc_len);
+        p = put_tag(p, "UB", r->seq, umi);
+        p = put_tag(p, "RX", r->seq, umi);
+    }
+
+    return (char *)p - out;
+}
+
+size_t sb_build_bam(const sb_builder_t *bd, const sb_rec_t *recs, int32_t n, char *out) {
+    return build_bam(bd, recs, n, out, 0, 0, 0);
+}
+
+size_t sb_build_bam_demux(const sb_builder_t *bd, const sb_rec_t *recs, int32_t n, char *out) {
+    return build_bam(bd, recs, n, out, 1, 0, 0);
+}
+
+size_t sb_build_bam_pieces(const sb_builder_t *bd, const sb_rec_t *recs, int32_t n, char *out) {
+    return build_bam(bd, recs, n, out, 0, 1, 0);
+}
+
+size_t sb_build_bam_pieces_demux(const sb_builder_t *bd, const sb_rec_t *recs, int32_t n, char *out) {
+    return build_bam(bd, recs, n, out, 1, 1, 0);
+}
+
+size_t sb_build_bam_linker(const sb_builder_t *bd, const sb_rec_t *recs, int32_t n, char *out) {
+    return build_bam(bd, recs, n, out, 0, 0, 1);
+}
+
+size_t sb_build_bam_linker_demux(const sb_builder_t *bd, const sb_rec_t *recs, int32_t n, char *out) {
+    return build_bam(bd, recs, n, out, 1, 0, 1);
+}
@@ -0,0 +1,62 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2022-2023 Jacob Morrison <jacob.morrison@vai.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef BAM_H
+#define BAM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "batch.h"
+#include "record.h"
+#include "kstring.h"
+
+#define SB_BAM_MAX_NAME 254 /* longest read name BAM can hold */
+
+// Bytes each BAM record takes beyond its name, sequence, and quality (upper bound): block size, fixed fields, name
+// terminator, and the CB, UB, and RX tags without their values
+#define SB_BAM_EXTRA 49
+
+// Append the BGZF compressed header of an unaligned BAM file (no reference sequences) to out
+// Returns 0 on success, -1 on error
+int sb_bam_header(kstring_t *out, int level);
+
+// Write n reads into out as unaligned BAM records with the barcode in CB and the UMI in UB and RX, trimming the UMI
+// and linker from the sequence. out must already have room for sb_build_size() bytes per read
+// Returns the number of bytes written
+size_t sb_build_bam(const sb_builder_t *bd, const sb_rec_t *recs, int32_t n, char *out);
+
+// Same as sb_build_bam(), taking each read's barcode from its index and skipping reads without one
+size_t sb_build_bam_demux(const sb_builder_t *bd, const sb_rec_t *recs, int32_t n, char *out);
+
+// Same as sb_build_bam() and sb_build_bam_demux(), taking the UMI and the sequence from the pieces of a read
+// structure (bd->st)
+size_t sb_build_bam_pieces(const sb_builder_t *bd, const sb_rec_t *recs, int32_t n, char *out);
+size_t sb_build_bam_pieces_demux(const sb_builder_t *bd, const sb_rec_t *recs, int32_t n, char *out);
+
+// Same as sb_build_bam() and sb_build_bam_demux(), leaving out reads that failed the linker check and starting the
+// sequence of the rest where their linker was found
+size_t sb_build_bam_linker(const sb_builder_t *bd, const sb_rec_t *recs, int32_t n, char *out);
+size_t sb_build_bam_linker_demux(const sb_builder_t *bd, const sb_rec_t *recs, int32_t n, char *out);
+
+#endif /* BAM_H */
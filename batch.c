@@ -0,0 +1,268 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2022-2023 Jacob Morrison <jacob.morrison@vai.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "batch.h"
+#include "record.h"
+#include "bam.h"
+#include "structure.h"
+#include "mem.h"
+
+sb_batch_t *sb_batch_init(int huge) {
+    sb_batch_t *b = (sb_batch_t *)calloc(1, sizeof(sb_batch_t));
+    if (!b) { return NULL; }
+
+    b->m    = SB_BATCH_RECS;
+    b->recs = (sb_rec_t *)calloc(b->m, sizeof(sb_rec_t));
+    if (!b->recs) {
+        free(b);
+        return NULL;
+    }
+    b->err  = -1;
+    b->huge = huge;
+
+    return b;
+}
+
+void sb_batch_destroy(sb_batch_t *b) {
+    if (!b) { return; }
+
+    sb_batch_destroy(b->mate);
+    free(b->recs);
+    sb_mem_free(&b->raw);
+    sb_mem_free(&b->data);
+    sb_mem_free(&b->out);
+    free(b->gz.s);
+    free(b->miss.s);
+    free(b->miss_gz.s);
+    free(b);
+}
+
+void sb_batch_reset(sb_batch_t *b) {
+    b->n         = 0;
+    b->err       = -1;
+    b->status    = SB_OK;
+    b->raw.l     = 0;
+    b->data.l    = 0;
+    b->out.l     = 0;
+    b->gz.l      = 0;
+    b->miss.l    = 0;
+    b->miss_gz.l = 0;
+}
+
+// Copy a field and its null-terminator into the batch storage
+static inline void push_field(kstring_t *s, const char *f, size_t l) {
+    if (l > 0) { memcpy(s->s + s->l, f, l); }
+    s->s[s->l + l] = '\0';
+    s->l += l + 1;
+}
+
+int sb_batch_reserve(sb_batch_t *b, int32_t n) {
+    if (n <= b->m) { return 0; }
+
+    int32_t m = b->m;
+    while (m < n) { m <<= 1; }
+    sb_rec_t *recs = (sb_rec_t *)realloc(b->recs, m * sizeof(sb_rec_t));
+    if (!recs) { return -1; }
+    b->recs = recs;
+    b->m    = m;
+
+    return 0;
+}
+
+int sb_batch_push(sb_batch_t *b, const char *name, size_t name_l, const char *comment, size_t comment_l,
+        const char *seq, size_t seq_l, const char *qual, size_t qual_l) {
+    if (sb_batch_reserve(b, b->n + 1) < 0) { return -1; }
+
+    // Fields are stored back to back, pointers are filled in by sb_batch_finalize()
+    size_t need = name_l + comment_l + seq_l + qual_l + 4;
+    if (sb_mem_resize(&b->data, b->data.l + need, b->huge) < 0) { return -1; }
+
+    sb_rec_t *r = &b->recs[b->n++];
+    r->name      = NULL;
+    r->name_l    = name_l;
+    r->comment_l = comment_l;
+    r->seq_l     = seq_l;
+    r->qual_l    = qual_l;
+
+    push_field(&b->data, name, name_l);
+    push_field(&b->data, comment, comment_l);
+    push_field(&b->data, seq, seq_l);
+    push_field(&b->data, qual, qual_l);
+
+    return 0;
+}
+
+void sb_batch_finalize(sb_batch_t *b) {
+    char *p = b->data.s;
+    int32_t i;
+    for (i = 0; i < b->n; i++) {
+        sb_rec_t *r = &b->recs[i];
+        if (r->name) { continue; } /* record points into the input */
+        r->name    = p; p += r->name_l    + 1;
+        r->comment = p; p += r->comment_l + 1;
+        r->seq     = p; p += r->seq_l     + 1;
+        r->qual    = p; p += r->qual_l    + 1;
+    }
+}
+
+int sb_batch_process(const sb_builder_t *bd, sb_batch_t *b) {
+    // Find the first read that can't be rewritten and the space needed for all reads before it
+    size_t  str_len  = 0;
+    size_t  miss_len = 0;
+    int32_t n_ok     = 0;
+    for (n_ok = 0; n_ok < b->n; n_ok++) {
+        const sb_rec_t *r = &b->recs[n_ok];
+
+        // FASTA records come back from the parser without a quality string, which can't be rewritten
+        if (r->qual_l != r->seq_l) {
+            b->err    = n_ok;
+            b->status = SB_ERR_NOQUAL;
+            break;
+        }
+
+        // Unmatched and rejected reads are written unchanged (or not at all), so they can be any length
+        if (bd->filter && r->bc < 0) {
+            if (r->bc == SB_BC_NONE) { miss_len += sb_plain_size(r); }
+            continue;
+        }
+
+        // Handle error case of too short read, seq and qual are the same length, so only check seq
+        if (r->seq_l < bd->min_len) {
+            b->err    = n_ok;
+            b->status = SB_ERR_SHORT;
+            break;
+        }
+        if (r->name_l > bd->max_name_l) {
+            b->err    = n_ok;
+            b->status = SB_ERR_BAMNAME;
+            break;
+        }
+        str_len += sb_build_size(bd, r);
+    }
+
+    if (sb_mem_resize(&b->out, b->out.l + str_len, b->huge) < 0 ||
+            (miss_len && ks_resize(&b->miss, b->miss.l + miss_len) < 0)) {
+        b->err    = 0;
+        b->status = SB_ERR_MEM;
+        return b->status;
+    }
+
+    b->out.l += bd->build(bd, b->recs, n_ok, b->out.s + b->out.l);
+    if (miss_len) { b->miss.l += sb_build_unmatched(b->recs, n_ok, b->miss.s + b->miss.l); }
+
+    return b->status;
+}
+
+// Names of two mates match if they are identical or differ only in a trailing /1 and /2
+static inline int names_match(const sb_rec_t *a, const sb_rec_t *b) {
+    if (a->name_l != b->name_l) { return 0; }
+
+    size_t l = a->name_l;
+    if (l >= 2 && a->name[l-2] == '/' && b->name[l-2] == '/') { l--; }
+
+    return memcmp(a->name, b->name, l) == 0;
+}
+
+int32_t sb_batch_check_mate(const sb_batch_t *b, int check_names, int32_t *status) {
+    const sb_batch_t *m = b->mate;
+
+    int32_t i;
+    for (i = 0; i < b->n; i++) {
+        if (check_names && !names_match(&b->recs[i], &m->recs[i])) {
+            *status = SB_ERR_NAME;
+            return i;
+        }
+        if (m->recs[i].qual_l != m->recs[i].seq_l) {
+            *status = SB_ERR_NOQUAL;
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+int sb_batch_passthrough(sb_batch_t *b, int32_t n, const sb_batch_t *reads) {
+    size_t str_len = 0;
+    int32_t i;
+    for (i = 0; i < n; i++) { str_len += sb_plain_size(&b->recs[i]); }
+
+    if (sb_mem_resize(&b->out, b->out.l + str_len, b->huge) < 0) { return -1; }
+    if (!reads) {
+        b->out.l += sb_build_plain(b->recs, n, b->out.s + b->out.l);
+        return 0;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (reads->recs[i].bc >= 0) { b->out.l += sb_build_plain(&b->recs[i], 1, b->out.s + b->out.l); }
+    }
+
+    return 0;
+}
+
+const char *sb_batch_error(const sb_conf_t *conf, const sb_batch_t *b, char *msg, size_t size) {
+    msg[0] = '\0';
+    switch (b->status) {
+        case SB_ERR_SHORT:
+            if (conf->structure) {
+                snprintf(msg, size, "Read shorter than read structure %s (%li < %zu)", conf->structure->text,
+                        b->recs[b->err].seq_l, conf->structure->min_len);
+                break;
+            }
+            snprintf(msg, size, "Read shorter than UMI and linker lengths provided (%li < %i)", b->recs[b->err].seq_l,
+                    conf->umi_length + conf->linker_length);
+            break;
+        case SB_ERR_MEM:
+            snprintf(msg, size, "Unable to reallocate sufficient space");
+            break;
+        case SB_ERR_COMPRESS:
+            snprintf(msg, size, "Unable to compress output");
+            break;
+        case SB_ERR_NOQUAL:
+            snprintf(msg, size, "Read has no quality string, input must be FASTQ");
+            break;
+        case SB_ERR_BAMNAME:
+            snprintf(msg, size, "Read name longer than %i characters can't be written to BAM (%.*s...)", SB_BAM_MAX_NAME,
+                    40, b->recs[b->err].name);
+            break;
+        case SB_ERR_TRUNC:
+            snprintf(msg, size, "Quality string length does not match sequence length (read %" PRIu64 ")",
+                    b->first + b->err + 1);
+            break;
+        case SB_ERR_READ:
+            snprintf(msg, size, "Error reading input file (corrupt or truncated)");
+            break;
+        case SB_ERR_NAME:
+            snprintf(msg, size, "Read names do not match between mates (%.*s and %.*s)", (int)b->recs[b->err].name_l,
+                    b->recs[b->err].name, (int)b->mate->recs[b->err].name_l, b->mate->recs[b->err].name);
+            break;
+        default:
+            break;
+    }
+
+    return msg;
+}
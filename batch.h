@@ -0,0 +1,122 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2022-2023 Jacob Morrison <jacob.morrison@vai.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "kstring.h"
+#include "synthbar.h"
+
+#define SB_BATCH_RECS 4096 /* reads read into each batch, and its initial record capacity (can grow) */
+#define SB_ERR_MSG    512  /* size of a buffer large enough for any batch error message */
+
+// Status codes for processing a batch
+#define SB_OK           0 /* all reads processed */
+#define SB_ERR_SHORT    1 /* read shorter than the UMI and linker lengths (or read structure) */
+#define SB_ERR_MEM      2 /* unable to allocate space for output */
+#define SB_ERR_COMPRESS 3 /* unable to compress output */
+#define SB_ERR_NOQUAL   4 /* read has no quality string (FASTA record) */
+#define SB_ERR_NAME     5 /* read names differ between mates */
+#define SB_ERR_BAMNAME  6 /* read name too long for BAM */
+#define SB_ERR_TRUNC    7 /* truncated quality string or quality and sequence lengths differ (reading input) */
+#define SB_ERR_READ     8 /* input could not be read or decompressed (corrupt or truncated) */
+
+#define SB_BC_NONE -1 /* read's barcode when it is copied to the unmatched output instead of rewritten */
+#define SB_BC_DROP -2 /* read's barcode when it is left out of the output altogether */
+
+typedef struct sb_builder_s sb_builder_t; /* rewriting pieces, see record.h */
+
+// A single FASTQ record, fields point into the input or the batch storage and are not null-terminated
+typedef struct {
+    char   *name;      /* read name */
+    char   *comment;   /* read comment (empty string if none) */
+    char   *seq;       /* sequence */
+    char   *qual;      /* quality */
+    size_t  name_l;    /* length of name */
+    size_t  comment_l; /* length of comment */
+    size_t  seq_l;     /* length of sequence */
+    size_t  qual_l;    /* length of quality */
+    int32_t bc;        /* barcode matching the read's index, or SB_BC_* (demultiplexing or linker check only) */
+    int32_t shift;     /* bases the linker was found after where expected (linker check only) */
+} sb_rec_t;
+
+// A block of consecutive reads from the input and their rewritten output
+typedef struct sb_batch_s {
+    uint64_t   idx;     /* position of batch in the input, used to keep output in order */
+    uint64_t   first;   /* number of reads in the input before the batch */
+    int32_t    n;       /* number of records in batch */
+    int32_t    m;       /* number of records allocated */
+    int32_t    err;     /* index of the first record that failed processing (-1 if none) */
+    int32_t    status;  /* SB_OK or the error hit at record err */
+    int32_t    huge;    /* raw, data, and out are backed by huge pages */
+    sb_rec_t  *recs;    /* records in batch */
+    kstring_t  raw;     /* streamed input that records point into (see mem.h) */
+    kstring_t  data;    /* storage for copied record fields (see mem.h) */
+    kstring_t  out;     /* rewritten reads, ready to be written (see mem.h) */
+    kstring_t  gz;      /* BGZF compressed copy of out (gzip output only) */
+    kstring_t  miss;    /* reads whose index matched no barcode, unchanged (demultiplexing only) */
+    kstring_t  miss_gz; /* BGZF compressed copy of miss (gzip output only) */
+
+    struct sb_batch_s *mate; /* same reads from the mate FASTQ (paired input only) */
+} sb_batch_t;
+
+// Create an empty batch, its buffers are kept (not freed) when it is reset so a batch can be refilled without
+// allocating. With huge, the input and output buffers are backed by huge pages where available
+sb_batch_t *sb_batch_init(int huge);
+void sb_batch_destroy(sb_batch_t *b);
+void sb_batch_reset(sb_batch_t *b);
+
+// Make room for at least n records
+// Returns 0 on success, -1 if memory could not be allocated
+int sb_batch_reserve(sb_batch_t *b, int32_t n);
+
+// Append a record to the batch, copying each field into the batch storage
+// Returns 0 on success, -1 if memory could not be allocated
+int sb_batch_push(sb_batch_t *b, const char *name, size_t name_l, const char *comment, size_t comment_l,
+        const char *seq, size_t seq_l, const char *qual, size_t qual_l);
+
+// Point each copied record at its fields once the batch storage will no longer move
+void sb_batch_finalize(sb_batch_t *b);
+
+// Rewrite every read in the batch into b->out. When demultiplexing, reads without a barcode go to b->miss unchanged
+// Returns SB_OK on success, otherwise the error code (failing read index stored in b->err)
+int sb_batch_process(const sb_builder_t *bd, sb_batch_t *b);
+
+// Find the first read whose mate can't be passed through: the mate has no quality string or, with check_names, the
+// read names differ
+// Returns the index of the read (error code stored in status), -1 if every mate is fine
+int32_t sb_batch_check_mate(const sb_batch_t *b, int check_names, int32_t *status);
+
+// Write the first n reads of the batch into b->out unchanged, leaving out the mates of reads that failed the linker
+// check if their batch, reads, is given
+// Returns 0 on success, -1 if memory could not be allocated
+int sb_batch_passthrough(sb_batch_t *b, int32_t n, const sb_batch_t *reads);
+
+// Describe the error hit by a batch that failed processing (empty if there was none)
+// Returns msg, which is filled with at most size bytes
+const char *sb_batch_error(const sb_conf_t *conf, const sb_batch_t *b, char *msg, size_t size);
+
+#endif /* BATCH_H */
@@ -0,0 +1,102 @@
+#!/usr/bin/env bash
+#
+# Time synthbar over a fixed set of modes on deterministic synthetic input (run through `make bench`)
+#
+# Settings come from the environment:
+#   SYNTHBAR   binary to benchmark                        [./synthbar]
+#   GEN        synthetic FASTQ generator                  [./bench/gen_fastq]
+#   BENCH_DIR  directory for generated input and output   [bench/data]
+#   READS      reads per input file                       [1000000]
+#   LENGTH     bases per read                             [100]
+#   UMI        UMI length                                 [8]
+#   LINKER     linker length                              [6]
+#   COMMENT    1 to give reads an Illumina comment        [1]
+#   THREADS    thread counts to time                      [1 and the number of CPUs]
+#   INPUTS     input formats to time                      [plain gzip bgzf]
+#   REPEAT     runs per mode, the fastest is reported     [3]
+#   CSV        results file                               [$BENCH_DIR/results.csv]
+#
+# Results are printed as a table and written as CSV with one row per mode:
+#   input,mode,threads,reads,seconds,reads_per_sec,mb_per_sec
+# where MB/s is decompressed input bytes per second
+set -euo pipefail
+
+SYNTHBAR=${SYNTHBAR:-./synthbar}
+GEN=${GEN:-./bench/gen_fastq}
+BENCH_DIR=${BENCH_DIR:-bench/data}
+READS=${READS:-1000000}
+LENGTH=${LENGTH:-100}
+UMI=${UMI:-8}
+LINKER=${LINKER:-6}
+COMMENT=${COMMENT:-1}
+NCPU=$(getconf _NPROCESSORS_ONLN 2>/dev/null || echo 1)
+THREADS=${THREADS:-$( [ "$NCPU" -gt 1 ] && echo "1 $NCPU" || echo 1 )}
+INPUTS=${INPUTS:-plain gzip bgzf}
+REPEAT=${REPEAT:-3}
+CSV=${CSV:-$BENCH_DIR/results.csv}
+
+mkdir -p "$BENCH_DIR"
+
+# Generate each input once, the name records every setting so a changed setting makes a new file
+comment_flag=$( [ "$COMMENT" = 1 ] && echo "-c" || true )
+input_file() {
+    local ext=fastq
+    [ "$1" != plain ] && ext=fastq.gz
+    echo "$BENCH_DIR/synth_n${READS}_L${LENGTH}_u${UMI}_l${LINKER}_c${COMMENT}_$1.$ext"
+}
+for fmt in $INPUTS; do
+    fn=$(input_file "$fmt")
+    if [ ! -s "$fn" ]; then
+        echo "Generating $fn" >&2
+        "$GEN" -n "$READS" -L "$LENGTH" -u "$UMI" -l "$LINKER" $comment_flag -f "$fmt" "$fn.tmp"
+        mv "$fn.tmp" "$fn"
+    fi
+done
+
+# An index map matching the generator's indexes, for the demultiplexing mode
+printf 'ACGTACGT\tAAAAAAAA\nTGCATGCA\tCCCCCCCC\nGATCGATC\tGGGGGGGG\nCTAGCTAG\tTTTTTTTT\n' > "$BENCH_DIR/indexes.tsv"
+
+# Mode name and the options it adds
+MODES=(
+    "default|"
+    "umi-first|-U"
+    "remove-linker|-r -u $UMI -l $LINKER"
+    "umi-first+remove-linker|-U -r -u $UMI -l $LINKER"
+    "barcode-16|-b ACGTACGTACGTACGT"
+    "gzip-out|-z --level 1"
+)
+[ "$COMMENT" = 1 ] && MODES+=("demux|--index-map $BENCH_DIR/indexes.tsv --index-mismatch --unmatched /dev/null")
+
+# Print a field of a --stats-json report
+json_field() {
+    sed -n "s/.*\"$2\": \([0-9.]*\).*/\1/p" "$1" | head -1
+}
+
+echo "input,mode,threads,reads,seconds,reads_per_sec,mb_per_sec" > "$CSV"
+printf "%-6s  %-24s  %7s  %10s  %8s  %12s  %8s\n" input mode threads reads seconds reads/s MB/s
+for fmt in $INPUTS; do
+    fn=$(input_file "$fmt")
+    for mode in "${MODES[@]}"; do
+        name=${mode%%|*}
+        opts=${mode#*|}
+        for t in $THREADS; do
+            best=""
+            for ((r = 0; r < REPEAT; r++)); do
+                # shellcheck disable=SC2086
+                "$SYNTHBAR" $opts -@ "$t" -o /dev/null --stats-json "$BENCH_DIR/stats.json" "$fn" 2>/dev/null
+                secs=$(json_field "$BENCH_DIR/stats.json" wall_seconds)
+                if [ -z "$best" ] || awk "BEGIN { exit !($secs < $best) }"; then
+                    best=$secs
+                    reads=$(json_field "$BENCH_DIR/stats.json" reads)
+                    bytes=$(json_field "$BENCH_DIR/stats.json" bytes)
+                fi
+            done
+            line=$(awk -v r="$reads" -v b="$bytes" -v s="$best" \
+                'BEGIN { if (s <= 0) s = 1e-9; printf "%s,%.6f,%.0f,%.1f", r, s, r / s, b / s / 1e6 }')
+            echo "$fmt,$name,$t,$line" >> "$CSV"
+            IFS=, read -r reads secs rps mbps <<< "$line"
+            printf "%-6s  %-24s  %7s  %10s  %8.3f  %12s  %8s\n" "$fmt" "$name" "$t" "$reads" "$secs" "$rps" "$mbps"
+        done
+    done
+done
+echo "Results written to $CSV" >&2
@@ -0,0 +1,227 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2022-2023 Jacob Morrison <jacob.morrison@vai.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+// Deterministic synthetic FASTQ generator for `make bench`
+//
+// Every read is: UMI, linker, then cDNA bases, so the output looks like the input synthbar expects. The same seed and
+// options always produce the same file, byte for byte, so benchmark results can be compared across commits
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <zlib.h>
+
+#include "../bgzf.h"
+#include "../kstring.h"
+
+#define GEN_BUFSIZE (1 << 20) /* bytes of FASTQ generated before each write */
+
+// Output formats
+enum { GEN_PLAIN, GEN_GZIP, GEN_BGZF };
+
+// Generator options
+typedef struct {
+    uint64_t n_reads;     /* number of reads */
+    int32_t  read_length; /* total bases per read, including UMI and linker */
+    int32_t  umi_length;  /* number of bases in UMI */
+    int32_t  link_length; /* number of bases in linker */
+    int32_t  comment;     /* add an Illumina comment (1:N:0:INDEX) to each read */
+    int32_t  format;      /* GEN_PLAIN, GEN_GZIP, or GEN_BGZF */
+    uint64_t seed;        /* random seed */
+} gen_conf_t;
+
+// xorshift64*, fast and identical on every platform
+static inline uint64_t next_rand(uint64_t *s) {
+    *s ^= *s >> 12;
+    *s ^= *s << 25;
+    *s ^= *s >> 27;
+
+    return *s * 0x2545F4914F6CDD1DULL;
+}
+
+// Append one read to out
+// Returns 0 on success, -1 if memory could not be allocated
+static int gen_read(const gen_conf_t *conf, uint64_t i, uint64_t *rng, const char *linker, kstring_t *out) {
+    static const char bases[4] = {'A', 'C', 'G', 'T'};
+    static const char quals[8] = {'F', 'F', 'F', 'F', ':', ':', ',', '#'};
+    static const char *indexes[4] = {"ACGTACGT", "TGCATGCA", "GATCGATC", "CTAGCTAG"};
+
+    int32_t  j, l = conf->read_length;
+    uint64_t r = 0;
+    if (ksprintf(out, "@synth.%llu", (unsigned long long)i) < 0 ||
+            (conf->comment && ksprintf(out, " 1:N:0:%s", indexes[i & 3]) < 0) || kputc('\n', out) < 0 ||
+            ks_resize(out, out->l + 2*l + 4) < 0) {
+        return -1;
+    }
+    char *p = out->s + out->l;
+    for (j = 0; j < l; j++) {
+        if ((j & 31) == 0) { r = next_rand(rng); }
+        if (j >= conf->umi_length && j < conf->umi_length + conf->link_length) {
+            p[j] = linker[j - conf->umi_length];
+        } else {
+            p[j] = bases[(r >> 2*(j & 31)) & 3];
+        }
+    }
+    p += l;
+    memcpy(p, "\n+\n", 3);
+    p += 3;
+    for (j = 0; j < l; j++) {
+        if ((j % 21) == 0) { r = next_rand(rng); }
+        p[j] = quals[(r >> 3*(j % 21)) & 7];
+    }
+    p[l] = '\n';
+    out->l += 2*l + 4;
+
+    return 0;
+}
+
+static int usage() {
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Usage: gen_fastq [options] <output FASTQ>\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "    -n, --reads INT            number of reads [1000000]\n");
+    fprintf(stderr, "    -L, --read-length INT      bases per read, including UMI and linker [100]\n");
+    fprintf(stderr, "    -u, --umi-length INT       length of UMI at the start of each read [8]\n");
+    fprintf(stderr, "    -l, --linker-length INT    length of linker after the UMI [6]\n");
+    fprintf(stderr, "    -c, --comment              add an Illumina comment (1:N:0:INDEX) to each read [off]\n");
+    fprintf(stderr, "    -f, --format STR           plain, gzip, or bgzf [plain]\n");
+    fprintf(stderr, "    -s, --seed INT             random seed [1]\n");
+    fprintf(stderr, "\n");
+
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    gen_conf_t conf = {1000000, 100, 8, 6, 0, GEN_PLAIN, 1};
+    int c;
+
+    static const struct option loptions[] = {
+        {"reads"        , required_argument, NULL, 'n'},
+        {"read-length"  , required_argument, NULL, 'L'},
+        {"umi-length"   , required_argument, NULL, 'u'},
+        {"linker-length", required_argument, NULL, 'l'},
+        {"comment"      , no_argument      , NULL, 'c'},
+        {"format"       , required_argument, NULL, 'f'},
+        {"seed"         , required_argument, NULL, 's'},
+        {"help"         , no_argument      , NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    while ((c = getopt_long(argc, argv, "n:L:u:l:f:s:ch", loptions, NULL)) >= 0) {
+        switch (c) {
+            case 'n': conf.n_reads     = strtoull(optarg, NULL, 10); break;
+            case 'L': conf.read_length = atoi(optarg); break;
+            case 'u': conf.umi_length  = atoi(optarg); break;
+            case 'l': conf.link_length = atoi(optarg); break;
+            case 'c': conf.comment     = 1; break;
+            case 's': conf.seed        = strtoull(optarg, NULL, 10); break;
+            case 'f':
+                if (strcmp(optarg, "plain") == 0) {
+                    conf.format = GEN_PLAIN;
+                } else if (strcmp(optarg, "gzip") == 0) {
+                    conf.format = GEN_GZIP;
+                } else if (strcmp(optarg, "bgzf") == 0) {
+                    conf.format = GEN_BGZF;
+                } else {
+                    fprintf(stderr, "Unknown format: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'h':
+                usage();
+                return 0;
+            default:
+                usage();
+                return 1;
+        }
+    }
+    if (optind >= argc) {
+        usage();
+        fprintf(stderr, "Please provide an output file\n");
+        return 1;
+    }
+    if (conf.read_length < 1 || conf.umi_length < 0 || conf.link_length < 0 ||
+            conf.umi_length + conf.link_length > conf.read_length) {
+        fprintf(stderr, "UMI (%i) and linker (%i) must fit in the read length (%i)\n", conf.umi_length,
+                conf.link_length, conf.read_length);
+        return 1;
+    }
+    const char *fn = argv[optind];
+
+    FILE      *fp = NULL;
+    gzFile     gz = NULL;
+    sb_bgzf_t *z  = NULL;
+    if (conf.format == GEN_GZIP) {
+        gz = gzopen(fn, "wb6");
+    } else {
+        fp = fopen(fn, "wb");
+        if (conf.format == GEN_BGZF) { z = sb_bgzf_init(6); }
+    }
+    if ((!fp && !gz) || (conf.format == GEN_BGZF && !z)) {
+        fprintf(stderr, "Could not open output file: %s\n", fn);
+        return 1;
+    }
+
+    // The linker is the same for every read, like a real protocol's
+    uint64_t rng = conf.seed * 0x9E3779B97F4A7C15ULL + 1;
+    char    *linker = (char *)malloc(conf.link_length + 1);
+    int32_t  j;
+    for (j = 0; j < conf.link_length; j++) { linker[j] = "ACGT"[next_rand(&rng) & 3]; }
+
+    kstring_t out = {0, 0, NULL};
+    kstring_t bgz = {0, 0, NULL};
+    int       err = 0;
+    uint64_t  i;
+    for (i = 0; i < conf.n_reads && !err; i++) {
+        if (gen_read(&conf, i, &rng, linker, &out) < 0) {
+            fprintf(stderr, "Unable to allocate output buffer\n");
+            err = 1;
+            break;
+        }
+        if (out.l < GEN_BUFSIZE && i + 1 < conf.n_reads) { continue; }
+
+        if (gz) {
+            err = gzwrite(gz, out.s, (unsigned)out.l) != (int)out.l;
+        } else if (z) {
+            bgz.l = 0;
+            err   = sb_bgzf_compress(z, &bgz, out.s, out.l) < 0 || fwrite(bgz.s, 1, bgz.l, fp) != bgz.l;
+        } else {
+            err = fwrite(out.s, 1, out.l, fp) != out.l;
+        }
+        out.l = 0;
+    }
+    if (z && !err) { err = fwrite(SB_BGZF_EOF, 1, SB_BGZF_EOF_SIZE, fp) != SB_BGZF_EOF_SIZE; }
+
+    if (gz && gzclose(gz) != Z_OK) { err = 1; }
+    if (fp && fclose(fp) != 0) { err = 1; }
+    if (err) { fprintf(stderr, "Error writing output file: %s\n", fn); }
+
+    sb_bgzf_destroy(z);
+    free(bgz.s);
+    free(out.s);
+    free(linker);
+
+    return err;
+}
@@ -0,0 +1,141 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2022-2023 Jacob Morrison <jacob.morrison@vai.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "bgzf.h"
+
+const uint8_t SB_BGZF_EOF[SB_BGZF_EOF_SIZE] = {
+    0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x06, 0x00, 0x42, 0x43,
+    0x02, 0x00, 0x1b, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static inline uint32_t get_u16(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8);
+}
+
+static inline uint32_t get_u32(const uint8_t *p) {
+    return get_u16(p) | (get_u16(p + 2) << 16);
+}
+
+static inline void put_u16(uint8_t *p, uint32_t v) {
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+}
+
+static inline void put_u32(uint8_t *p, uint32_t v) {
+    put_u16(p, v & 0xffff);
+    put_u16(p + 2, v >> 16);
+}
+
+sb_bgzf_t *sb_bgzf_init(int level) {
+    sb_bgzf_t *z = (sb_bgzf_t *)calloc(1, sizeof(sb_bgzf_t));
+    if (!z) { return NULL; }
+
+    // Negative window bits gives raw deflate data, the gzip wrapper is written by hand to hold the BC field
+    z->level = level;
+    if (deflateInit2(&z->zs, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        free(z);
+        return NULL;
+    }
+
+    return z;
+}
+
+void sb_bgzf_destroy(sb_bgzf_t *z) {
+    if (!z) { return; }
+
+    deflateEnd(&z->zs);
+    free(z);
+}
+
+// Compress a single block of at most SB_BGZF_BLOCK_SIZE bytes to dst, which has room for SB_BGZF_MAX_BLOCK bytes
+// Returns the size of the block, -1 on error
+static int compress_block(sb_bgzf_t *z, uint8_t *dst, const char *src, size_t len) {
+    if (deflateReset(&z->zs) != Z_OK) { return -1; }
+
+    z->zs.next_in   = (Bytef *)src;
+    z->zs.avail_in  = (uInt)len;
+    z->zs.next_out  = dst + SB_BGZF_HDR_SIZE;
+    z->zs.avail_out = SB_BGZF_MAX_BLOCK - SB_BGZF_HDR_SIZE - 8;
+    if (deflate(&z->zs, Z_FINISH) != Z_STREAM_END) { return -1; }
+
+    int block_len = SB_BGZF_HDR_SIZE + (int)z->zs.total_out + 8;
+
+    // gzip header: magic, deflate, FEXTRA, mtime, XFL, OS, XLEN, then BC subfield holding block size - 1
+    static const uint8_t hdr[16] = {
+        0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x06, 0x00, 0x42, 0x43, 0x02, 0x00
+    };
+    memcpy(dst, hdr, sizeof(hdr));
+    put_u16(dst + 16, block_len - 1);
+
+    // Footer: CRC32 and uncompressed size
+    uint8_t *ftr = dst + block_len - 8;
+    put_u32(ftr, crc32(crc32(0L, Z_NULL, 0), (const Bytef *)src, (uInt)len));
+    put_u32(ftr + 4, (uint32_t)len);
+
+    return block_len;
+}
+
+int sb_bgzf_compress(sb_bgzf_t *z, kstring_t *out, const char *data, size_t len) {
+    while (len > 0) {
+        size_t n = len < SB_BGZF_BLOCK_SIZE ? len : SB_BGZF_BLOCK_SIZE;
+
+        if (ks_resize(out, out->l + SB_BGZF_MAX_BLOCK) < 0) { return -1; }
+
+        int block_len = compress_block(z, (uint8_t *)out->s + out->l, data, n);
+        if (block_len < 0) { return -1; }
+
+        out->l += block_len;
+        data   += n;
+        len    -= n;
+    }
+
+    return 0;
+}
+
+int sb_bgzf_block_size(const uint8_t *hdr, size_t n) {
+    // Same check as htslib: gzip magic, FEXTRA flag, and a 6 byte extra field holding only the BC subfield
+    if (n < SB_BGZF_HDR_SIZE) { return -1; }
+    if (hdr[0] != 0x1f || hdr[1] != 0x8b || hdr[2] != 0x08 || (hdr[3] & 0x04) == 0) { return -1; }
+    if (get_u16(hdr + 10) != 6 || hdr[12] != 'B' || hdr[13] != 'C' || get_u16(hdr + 14) != 2) { return -1; }
+
+    return (int)get_u16(hdr + 16) + 1;
+}
+
+int sb_bgzf_decompress(sb_decomp_t *d, kstring_t *out, const uint8_t *block, size_t len) {
+    if (len < SB_BGZF_HDR_SIZE + 8) { return -1; }
+
+    uint32_t crc   = get_u32(block + len - 8);
+    uint32_t isize = get_u32(block + len - 4);
+    if (isize > SB_BGZF_MAX_BLOCK || ks_resize(out, out->l + isize + 1) < 0) { return -1; }
+    if (isize == 0) { return 0; }
+
+    uint8_t *dst = (uint8_t *)out->s + out->l;
+    if (sb_decomp_block(d, dst, isize, block + SB_BGZF_HDR_SIZE, len - SB_BGZF_HDR_SIZE - 8) < 0) { return -1; }
+    if (sb_decomp_crc32(d, 0, dst, isize) != crc) { return -1; }
+    out->l += isize;
+
+    return 0;
+}
@@ -0,0 +1,64 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2022-2023 Jacob Morrison <jacob.morrison@vai.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef BGZF_H
+#define BGZF_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <zlib.h>
+
+#include "kstring.h"
+#include "decomp.h"
+
+#define SB_BGZF_BLOCK_SIZE 0xff00 /* maximum uncompressed bytes per block, matches htslib */
+#define SB_BGZF_MAX_BLOCK  0x10000 /* maximum compressed size of a block */
+#define SB_BGZF_HDR_SIZE   18     /* gzip header with BC extra field */
+#define SB_BGZF_EOF_SIZE   28     /* size of empty end-of-file block */
+
+// Empty block marking the end of a BGZF file
+extern const uint8_t SB_BGZF_EOF[SB_BGZF_EOF_SIZE];
+
+// Compressor state, each thread compressing blocks needs its own
+typedef struct {
+    z_stream zs;    /* raw deflate stream, reset for each block */
+    int      level; /* compression level */
+} sb_bgzf_t;
+
+// Returns NULL if zlib could not be initialized
+sb_bgzf_t *sb_bgzf_init(int level);
+void sb_bgzf_destroy(sb_bgzf_t *z);
+
+// Compress len bytes of data into independent BGZF blocks appended to out
+// Returns 0 on success, -1 on error
+int sb_bgzf_compress(sb_bgzf_t *z, kstring_t *out, const char *data, size_t len);
+
+// Check whether the first n bytes of a file start a BGZF block
+// Returns the size of the whole block if so, -1 otherwise
+int sb_bgzf_block_size(const uint8_t *hdr, size_t n);
+
+// Decompress one complete BGZF block of len bytes, appending the data to out
+// Returns 0 on success, -1 if the block is corrupt
+int sb_bgzf_decompress(sb_decomp_t *d, kstring_t *out, const uint8_t *block, size_t len);
+
+#endif /* BGZF_H */
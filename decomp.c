@@ -0,0 +1,328 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2022-2023 Jacob Morrison <jacob.morrison@vai.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#ifdef HAVE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+
+#include "decomp.h"
+
+#define SB_GZIN_BUFSIZE (1 << 20) /* compressed bytes read at once by streamed readers */
+#define SB_GZ_BUFSIZE   (1 << 15) /* zlib buffer, reads of twice this or more skip it and go straight to the caller */
+
+static const char *backend_names[SB_INFLATE_N] = { "zlib", "libdeflate" };
+
+int sb_decomp_parse(const char *name) {
+    if (strcmp(name, "auto") == 0) { return SB_INFLATE_AUTO; }
+
+    int i;
+    for (i = 0; i < SB_INFLATE_N; i++) {
+        if (strcmp(name, backend_names[i]) == 0) { return i; }
+    }
+
+    return -2;
+}
+
+const char *sb_decomp_name(int id) {
+    return id >= 0 && id < SB_INFLATE_N ? backend_names[id] : "auto";
+}
+
+int sb_decomp_available(int id) {
+    switch (id) {
+        case SB_INFLATE_AUTO:
+        case SB_INFLATE_ZLIB:
+            return 1;
+#ifdef HAVE_LIBDEFLATE
+        case SB_INFLATE_LIBDEFLATE:
+            return 1;
+#endif
+        default:
+            return 0;
+    }
+}
+
+int sb_decomp_resolve(int id) {
+    if (id == SB_INFLATE_AUTO) { id = SB_INFLATE_LIBDEFLATE; }
+
+    return sb_decomp_available(id) ? id : SB_INFLATE_ZLIB;
+}
+
+struct sb_decomp_s {
+    int                             id; /* backend in use */
+    z_stream                        zs; /* zlib raw inflate stream */
+#ifdef HAVE_LIBDEFLATE
+    struct libdeflate_decompressor *ld;
+#endif
+};
+
+sb_decomp_t *sb_decomp_init(int id) {
+    sb_decomp_t *d = (sb_decomp_t *)calloc(1, sizeof(sb_decomp_t));
+    if (!d) { return NULL; }
+
+    d->id = sb_decomp_resolve(id);
+
+    int ok = 0;
+    switch (d->id) {
+#ifdef HAVE_LIBDEFLATE
+        case SB_INFLATE_LIBDEFLATE:
+            ok = (d->ld = libdeflate_alloc_decompressor()) != NULL;
+            break;
+#endif
+        default:
+            d->id = SB_INFLATE_ZLIB;
+            ok = inflateInit2(&d->zs, -15) == Z_OK;
+            break;
+    }
+    if (!ok) {
+        free(d);
+        return NULL;
+    }
+
+    return d;
+}
+
+void sb_decomp_destroy(sb_decomp_t *d) {
+    if (!d) { return; }
+
+    switch (d->id) {
+#ifdef HAVE_LIBDEFLATE
+        case SB_INFLATE_LIBDEFLATE:
+            libdeflate_free_decompressor(d->ld);
+            break;
+#endif
+        default:
+            inflateEnd(&d->zs);
+            break;
+    }
+    free(d);
+}
+
+int sb_decomp_block(sb_decomp_t *d, uint8_t *dst, size_t dst_len, const uint8_t *src, size_t src_len) {
+    switch (d->id) {
+#ifdef HAVE_LIBDEFLATE
+        case SB_INFLATE_LIBDEFLATE: {
+            // Whole buffer in one call, with no stream state to keep up to date
+            size_t n = 0;
+            if (libdeflate_deflate_decompress(d->ld, src, src_len, dst, dst_len, &n) != LIBDEFLATE_SUCCESS) {
+                return -1;
+            }
+            return n == dst_len ? 0 : -1;
+        }
+#endif
+        default:
+            if (inflateReset(&d->zs) != Z_OK) { return -1; }
+            d->zs.next_in   = (Bytef *)src;
+            d->zs.avail_in  = (uInt)src_len;
+            d->zs.next_out  = (Bytef *)dst;
+            d->zs.avail_out = (uInt)dst_len;
+            if (inflate(&d->zs, Z_FINISH) != Z_STREAM_END || d->zs.total_out != dst_len) { return -1; }
+            return 0;
+    }
+}
+
+uint32_t sb_decomp_crc32(sb_decomp_t *d, uint32_t crc, const uint8_t *buf, size_t len) {
+    switch (d->id) {
+#ifdef HAVE_LIBDEFLATE
+        case SB_INFLATE_LIBDEFLATE:
+            return libdeflate_crc32(crc, buf, len);
+#endif
+        default:
+            return (uint32_t)crc32_z(crc, buf, len);
+    }
+}
+
+struct sb_gzin_s {
+    gzFile    gz;        /* zlib handle (input opened by name) */
+    FILE     *fp;        /* raw input (reading from a stream) */
+    uint8_t  *in;        /* compressed input buffer */
+    int       is_gzip;   /* input is gzip compressed (otherwise passed through) */
+    int       in_member; /* in the middle of a gzip member */
+    int       eof;       /* all of fp has been read */
+    int       err;       /* input is corrupt or truncated */
+    z_stream  zs;        /* zlib inflate state when reading from fp */
+};
+
+// Refill zlib's compressed input buffer once it is used up
+static void zlib_refill(sb_gzin_t *g) {
+    if (g->zs.avail_in > 0 || g->eof) { return; }
+
+    size_t n = fread(g->in, 1, SB_GZIN_BUFSIZE, g->fp);
+    if (n == 0) {
+        g->eof = 1;
+        if (ferror(g->fp)) { g->err = 1; }
+    }
+    g->zs.next_in  = g->in;
+    g->zs.avail_in = (uInt)n;
+}
+
+// Read from a gzip (possibly multi-member) or uncompressed stream with zlib's inflate, as gzread can only read from a
+// file descriptor
+static int zlib_read(sb_gzin_t *g, void *buf, int len) {
+    if (g->err) { return -1; }
+
+    if (!g->is_gzip) {
+        // Hand back what was peeked at before reading the rest of the stream directly
+        if (g->zs.avail_in > 0) {
+            uInt n = g->zs.avail_in < (uInt)len ? g->zs.avail_in : (uInt)len;
+            memcpy(buf, g->zs.next_in, n);
+            g->zs.next_in  += n;
+            g->zs.avail_in -= n;
+            return (int)n;
+        }
+        size_t n = fread(buf, 1, len, g->fp);
+        if (n == 0 && ferror(g->fp)) { return -1; }
+        return (int)n;
+    }
+
+    for (;;) {
+        zlib_refill(g);
+        if (g->err) { return -1; }
+
+        // Start the next gzip member, if there is one
+        if (!g->in_member) {
+            if (g->zs.avail_in == 0 && g->eof) { return 0; }
+            if (inflateReset(&g->zs) != Z_OK) {
+                g->err = 1;
+                return -1;
+            }
+            g->in_member = 1;
+        }
+
+        g->zs.next_out  = (Bytef *)buf;
+        g->zs.avail_out = (uInt)len;
+        int ret = inflate(&g->zs, Z_NO_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+            g->err = 1;
+            return -1;
+        }
+        int n = len - (int)g->zs.avail_out;
+
+        if (ret == Z_STREAM_END) {
+            g->in_member = 0;
+        } else if (n == 0 && g->zs.avail_in == 0 && g->eof) {
+            // Stream ended in the middle of a member
+            g->err = 1;
+            return -1;
+        }
+        if (n > 0) { return n; }
+    }
+}
+
+int sb_open_input(const char *fn) {
+    return strcmp(fn, "-") == 0 ? dup(STDIN_FILENO) : open(fn, O_RDONLY);
+}
+
+sb_gzin_t *sb_gzin_open(const char *fn) {
+    sb_gzin_t *g = (sb_gzin_t *)calloc(1, sizeof(sb_gzin_t));
+    if (!g) { return NULL; }
+
+    int fd = sb_open_input(fn);
+    if (fd < 0) {
+        free(g);
+        return NULL;
+    }
+
+    // zlib closes fd along with the stream, but not if it fails to open it. zlib's default 8K buffer is raised so that
+    // compressed input is read in larger pieces
+    g->gz = gzdopen(fd, "r");
+    if (!g->gz) {
+        close(fd);
+        free(g);
+        return NULL;
+    }
+    gzbuffer(g->gz, SB_GZ_BUFSIZE);
+
+    return g;
+}
+
+sb_gzin_t *sb_gzin_fopen(FILE *fp, const void *peek, size_t peek_l) {
+    sb_gzin_t *g = (sb_gzin_t *)calloc(1, sizeof(sb_gzin_t));
+    if (!g || (g->in = (uint8_t *)malloc(SB_GZIN_BUFSIZE)) == NULL) {
+        free(g);
+        fclose(fp);
+        return NULL;
+    }
+    g->fp = fp;
+
+    if (inflateInit2(&g->zs, 15 + 16) != Z_OK) {
+        fclose(fp);
+        free(g->in);
+        free(g);
+        return NULL;
+    }
+    if (peek_l > 0) {
+        memcpy(g->in, peek, peek_l);
+        g->zs.next_in  = g->in;
+        g->zs.avail_in = (uInt)peek_l;
+    }
+    zlib_refill(g);
+    g->is_gzip = g->zs.avail_in >= 2 && g->in[0] == 0x1f && g->in[1] == 0x8b;
+
+    return g;
+}
+
+void sb_gzin_close(sb_gzin_t *g) {
+    if (!g) { return; }
+
+    if (g->fp) {
+        inflateEnd(&g->zs);
+        fclose(g->fp);
+        free(g->in);
+    } else {
+        gzclose(g->gz);
+    }
+    free(g);
+}
+
+// Read from the stream until buf is full or the stream ends, as gzread does, since callers take a short read as the end.
+// Like gzread, bytes read before an error are returned, and the error is left for sb_gzin_error()
+static int read_full(sb_gzin_t *g, char *buf, int len) {
+    int got = 0;
+    while (got < len) {
+        int n = zlib_read(g, buf + got, len - got);
+        if (n < 0) { return got > 0 ? got : -1; }
+        if (n == 0) { break; }
+        got += n;
+    }
+
+    return got;
+}
+
+int sb_gzin_read(sb_gzin_t *g, void *buf, int len) {
+    return g->fp ? read_full(g, (char *)buf, len) : gzread(g->gz, buf, (unsigned)len);
+}
+
+int sb_gzin_error(sb_gzin_t *g) {
+    if (g->fp) { return g->err; }
+
+    int err = Z_OK;
+    gzerror(g->gz, &err);
+    return err != Z_OK;
+}
@@ -0,0 +1,86 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2022-2023 Jacob Morrison <jacob.morrison@vai.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef DECOMP_H
+#define DECOMP_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// Libraries that can inflate input, libdeflate is optional at build time (see Makefile)
+enum {
+    SB_INFLATE_AUTO = -1, /* fastest library built in */
+    SB_INFLATE_ZLIB = 0,
+    SB_INFLATE_LIBDEFLATE,
+    SB_INFLATE_N
+};
+
+// Returns the backend named by name, -1 if the name is unknown
+int sb_decomp_parse(const char *name);
+const char *sb_decomp_name(int id);
+
+// Returns 1 if the backend was built in, 0 otherwise
+int sb_decomp_available(int id);
+
+// Pick the backend to use for whole BGZF blocks, zlib if the one asked for wasn't built in
+int sb_decomp_resolve(int id);
+
+// Raw deflate decompressor for whole blocks, each thread needs its own
+typedef struct sb_decomp_s sb_decomp_t;
+
+// Returns NULL if the decompressor could not be created
+sb_decomp_t *sb_decomp_init(int id);
+void sb_decomp_destroy(sb_decomp_t *d);
+
+// Inflate the raw deflate data in src, which must decompress to exactly dst_len bytes
+// Returns 0 on success, -1 if the data is corrupt
+int sb_decomp_block(sb_decomp_t *d, uint8_t *dst, size_t dst_len, const uint8_t *src, size_t src_len);
+
+// Update a gzip CRC32 with len bytes of buf
+uint32_t sb_decomp_crc32(sb_decomp_t *d, uint32_t crc, const uint8_t *buf, size_t len);
+
+// Open fn for reading, - for stdin (a duplicate of it, which can be closed without closing stdin)
+// Returns the file descriptor, -1 if the file could not be opened
+int sb_open_input(const char *fn);
+
+// Streamed reader for gzip compressed (or uncompressed) files, - for stdin
+typedef struct sb_gzin_s sb_gzin_t;
+
+// Streams are always inflated with zlib, as libdeflate has no streaming interface
+// Returns NULL if the file could not be opened
+sb_gzin_t *sb_gzin_open(const char *fn);
+
+// Stream from fp instead, which is closed along with the reader (or straight away if NULL is returned). The peek_l
+// bytes in peek were already read from fp by the caller, and are streamed ahead of the rest of it
+sb_gzin_t *sb_gzin_fopen(FILE *fp, const void *peek, size_t peek_l);
+void sb_gzin_close(sb_gzin_t *g);
+
+// Fills buf unless the end of the file is reached
+// Returns the number of bytes copied to buf, 0 at end of file, -1 on error
+int sb_gzin_read(sb_gzin_t *g, void *buf, int len);
+
+// Returns 1 if the stream stopped because of an error (including a truncated file), 0 otherwise
+int sb_gzin_error(sb_gzin_t *g);
+
+#endif /* DECOMP_H */
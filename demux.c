@@ -0,0 +1,331 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2022-2023 Jacob Morrison <jacob.morrison@vai.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "demux.h"
+#include "kstring.h"
+
+#define SB_DEMUX_EMPTY UINT64_MAX /* key of a free slot, packed indexes are at most 62 bits */
+
+// 2-bit code of each base plus one, 0 for anything else
+static const uint8_t base_code[256] = {
+    ['A'] = 1, ['C'] = 2, ['G'] = 3, ['T'] = 4, ['a'] = 1, ['c'] = 2, ['g'] = 3, ['t'] = 4,
+};
+
+// Returns the 2-bit code of c, -1 if c is not A, C, G, or T
+static inline int code_of(char c) {
+    return (int)base_code[(uint8_t)c] - 1;
+}
+
+// Fibonacci hash of a packed index onto the table
+static inline uint64_t slot_of(const sb_demux_t *d, uint64_t key) {
+    return (key * 0x9E3779B97F4A7C15ULL) >> (64 - d->bits);
+}
+
+// Find the slot holding key
+// Returns the slot, NULL if key is not in the table
+static inline const sb_demux_slot_t *find_key(const sb_demux_t *d, uint64_t key) {
+    uint64_t mask = (1ULL << d->bits) - 1;
+    uint64_t i    = slot_of(d, key);
+    for (;; i = (i + 1) & mask) {
+        const sb_demux_slot_t *s = &d->slots[i];
+        if (s->key == key) { return s; }
+        if (s->key == SB_DEMUX_EMPTY) { return NULL; }
+    }
+}
+
+// Add key for barcode bc at dist mismatches. An exact index always wins; a neighbour reached from two different
+// indexes is kept but marked ambiguous so reads landing on it stay unmatched
+// Returns 0 on success, -1 if key is already an exact index (duplicate index in the file)
+static int insert_key(sb_demux_t *d, uint64_t key, int32_t bc, int32_t dist) {
+    uint64_t mask = (1ULL << d->bits) - 1;
+    uint64_t i    = slot_of(d, key);
+    for (;; i = (i + 1) & mask) {
+        sb_demux_slot_t *s = &d->slots[i];
+        if (s->key == SB_DEMUX_EMPTY) {
+            s->key  = key;
+            s->bc   = bc;
+            s->dist = dist;
+            return 0;
+        }
+        if (s->key != key) { continue; }
+
+        if (dist == 0) {
+            if (s->dist == 0) { return -1; }
+            s->bc   = bc;
+            s->dist = 0;
+        } else if (s->dist != 0 && s->bc != bc) {
+            s->bc = -1;
+        }
+        return 0;
+    }
+}
+
+// Pack an index (skipping the '+' of dual indexes) two bits per base
+// Returns 0 on success, -1 if the index has a base other than A, C, G, or T
+static int pack_index(const char *idx, int32_t l, int32_t sep, uint64_t *key) {
+    uint64_t k = 0;
+    int32_t i;
+    for (i = 0; i < l; i++) {
+        if (i == sep) { continue; }
+        int c = code_of(idx[i]);
+        if (c < 0) { return -1; }
+        k = (k << 2) | (uint64_t)c;
+    }
+    *key = k;
+
+    return 0;
+}
+
+sb_demux_t *sb_demux_load(const char *fn, int mismatch) {
+    FILE *fp = fopen(fn, "r");
+    if (!fp) {
+        fprintf(stderr, "Could not open index file: %s\n", fn);
+        return NULL;
+    }
+
+    sb_demux_t *d   = (sb_demux_t *)calloc(1, sizeof(sb_demux_t));
+    kstring_t   str = {0, 0, NULL};
+    char        buf[4096];
+    size_t      n;
+    while (d && (n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        if (kputsn(buf, n, &str) < 0) { break; }
+    }
+    int read_err = ferror(fp) || !feof(fp);
+    fclose(fp);
+    if (!d || read_err || kputc('\n', &str) < 0) {
+        fprintf(stderr, "Unable to read index file: %s\n", fn);
+        free(str.s);
+        free(d);
+        return NULL;
+    }
+    d->text     = str.s;
+    d->idx_len  = -1;
+    d->mismatch = mismatch;
+
+    // First pass: check each line and collect the indexes, which are packed once the table is sized
+    int32_t   m    = 0, line = 0;
+    char    **idxs = NULL;
+    char     *p    = d->text, *eol;
+    for (; (eol = strchr(p, '\n')) != NULL; p = eol + 1) {
+        line++;
+        *eol = '\0';
+        if (eol > p && eol[-1] == '\r') { eol[-1] = '\0'; }
+        if (*p == '\0' || *p == '#') { continue; }
+
+        char *tab = strchr(p, '\t');
+        if (!tab || tab == p || tab[1] == '\0' || strchr(tab + 1, '\t')) {
+            fprintf(stderr, "Index file line %i must be: index and barcode\n", line);
+            goto fail;
+        }
+        *tab = '\0';
+
+        int32_t l   = (int32_t)(tab - p);
+        char   *plus = strchr(p, '+');
+        int32_t sep = plus ? (int32_t)(plus - p) : -1;
+        uint64_t key;
+        if ((plus && strchr(plus + 1, '+')) || l - (sep >= 0) > SB_DEMUX_MAX_INDEX || pack_index(p, l, sep, &key) < 0) {
+            fprintf(stderr, "Index file line %i: index must be at most %i bases of A, C, G, and T (i7+i5 for dual "
+                    "indexes)\n", line, SB_DEMUX_MAX_INDEX);
+            goto fail;
+        }
+        if (d->idx_len < 0) {
+            d->idx_len = l;
+            d->sep     = sep;
+        } else if (l != d->idx_len || sep != d->sep) {
+            fprintf(stderr, "Index file line %i: all indexes must have the same length\n", line);
+            goto fail;
+        }
+
+        if (d->n_bcs == m) {
+            m = m ? m << 1 : 64;
+            char  **ni = (char **)realloc(idxs, m * sizeof(char *));
+            char  **nb = ni ? (char **)realloc(d->bcs, m * sizeof(char *)) : NULL;
+            if (ni) { idxs = ni; }
+            if (nb) { d->bcs = nb; }
+            if (!ni || !nb) {
+                fprintf(stderr, "Unable to allocate index table\n");
+                goto fail;
+            }
+        }
+        idxs[d->n_bcs]     = p;
+        d->bcs[d->n_bcs++] = tab + 1;
+    }
+
+    if (d->n_bcs == 0) {
+        fprintf(stderr, "No indexes found in index file: %s\n", fn);
+        goto fail;
+    }
+
+    // Keep the table at most a quarter full so probe runs stay within a cache line or two
+    int32_t  n_bases = d->idx_len - (d->sep >= 0);
+    uint64_t n_keys  = (uint64_t)d->n_bcs * (mismatch ? 3*n_bases + 1 : 1);
+    d->bits = 4;
+    while ((1ULL << d->bits) < 4*n_keys) { d->bits++; }
+    d->slots   = (sb_demux_slot_t *)malloc((1ULL << d->bits) * sizeof(sb_demux_slot_t));
+    d->bc_lens = (size_t *)malloc(d->n_bcs * sizeof(size_t));
+    if (!d->slots || !d->bc_lens) {
+        fprintf(stderr, "Unable to allocate index table\n");
+        goto fail;
+    }
+    uint64_t i;
+    for (i = 0; i < (1ULL << d->bits); i++) { d->slots[i].key = SB_DEMUX_EMPTY; }
+
+    // Exact indexes go in first so a neighbour of one index never shadows another index
+    int32_t j;
+    for (j = 0; j < d->n_bcs; j++) {
+        uint64_t key = 0;
+        pack_index(idxs[j], d->idx_len, d->sep, &key);
+        if (insert_key(d, key, j, 0) < 0) {
+            fprintf(stderr, "Index %s appears more than once in index file\n", idxs[j]);
+            goto fail;
+        }
+        d->bc_lens[j] = strlen(d->bcs[j]);
+        if (d->bc_lens[j] > d->max_bc_len) { d->max_bc_len = d->bc_lens[j]; }
+    }
+    for (j = 0; mismatch && j < d->n_bcs; j++) {
+        uint64_t key = 0;
+        pack_index(idxs[j], d->idx_len, d->sep, &key);
+        int32_t k;
+        for (k = 0; k < n_bases; k++) {
+            uint64_t c;
+            for (c = 1; c < 4; c++) { insert_key(d, key ^ (c << 2*k), j, 1); }
+        }
+    }
+
+    free(idxs);
+    return d;
+
+fail:
+    free(idxs);
+    sb_demux_destroy(d);
+    return NULL;
+}
+
+void sb_demux_destroy(sb_demux_t *d) {
+    if (!d) { return; }
+
+    free(d->slots);
+    free(d->bc_lens);
+    free(d->bcs);
+    free(d->text);
+    free(d);
+}
+
+// Pack bases [from, to) of idx onto *key without branching on the bases
+// Returns nonzero if any of them is not A, C, G, or T
+static inline int pack_run(const char *idx, int32_t from, int32_t to, uint64_t *key) {
+    uint64_t k   = *key;
+    int      bad = 0;
+    int32_t i;
+    for (i = from; i < to; i++) {
+        int c = base_code[(uint8_t)idx[i]];
+        bad  |= c == 0;
+        k     = (k << 2) | (uint64_t)((c - 1) & 3);
+    }
+    *key = k;
+
+    return bad;
+}
+
+// Look up an index holding a single N, which is then the one allowed mismatch, so the rest has to match exactly
+// Returns the barcode of the index, -1 if unmatched
+static int32_t lookup_n(const sb_demux_t *d, const char *idx) {
+    uint64_t key   = 0;
+    int32_t  n_pos = -1, k = d->idx_len - (d->sep >= 0);
+    int32_t  i;
+    for (i = 0; i < d->idx_len; i++) {
+        if (i == d->sep) { continue; }
+        int c = code_of(idx[i]);
+        k--;
+        if (c < 0) {
+            if (n_pos >= 0 || (idx[i] != 'N' && idx[i] != 'n')) { return -1; }
+            n_pos = k;
+            c     = 0;
+        }
+        key = (key << 2) | (uint64_t)c;
+    }
+
+    int32_t  bc = -1;
+    uint64_t c;
+    for (c = 0; c < 4; c++) {
+        const sb_demux_slot_t *s = find_key(d, key | (c << 2*n_pos));
+        if (!s || s->dist != 0) { continue; }
+        if (bc >= 0) { return -1; }
+        bc = s->bc;
+    }
+
+    return bc;
+}
+
+// Look up the d->idx_len bases of a read's index
+// Returns the barcode of the index (outcome stored in res), -1 if unmatched
+static inline int32_t lookup(const sb_demux_t *d, const char *idx, int *res) {
+    uint64_t key = 0;
+    int      bad;
+    if (d->sep < 0) {
+        bad = pack_run(idx, 0, d->idx_len, &key);
+    } else {
+        bad  = pack_run(idx, 0, d->sep, &key) | (idx[d->sep] != '+');
+        bad |= pack_run(idx, d->sep + 1, d->idx_len, &key);
+    }
+
+    if (!bad) {
+        const sb_demux_slot_t *s = find_key(d, key);
+        if (!s || s->bc < 0) { return -1; }
+        *res = s->dist ? SB_DEMUX_MISMATCH : SB_DEMUX_EXACT;
+        return s->bc;
+    }
+
+    if (!d->mismatch || (d->sep >= 0 && idx[d->sep] != '+')) { return -1; }
+    int32_t bc = lookup_n(d, idx);
+    if (bc >= 0) { *res = SB_DEMUX_MISMATCH; }
+
+    return bc;
+}
+
+void sb_demux_assign(sb_demux_t *d, sb_batch_t *b) {
+    uint64_t counts[SB_DEMUX_N] = {0};
+    size_t   l = (size_t)d->idx_len;
+
+    int32_t i;
+    for (i = 0; i < b->n; i++) {
+        sb_rec_t *r = &b->recs[i];
+
+        // Index is the last field of the first word of the comment (1:N:0:ACGTACGT). Indexes all have the same length,
+        // so it can only match if the word ends with ':' and the index
+        const char *e = (const char *)memchr(r->comment, ' ', r->comment_l);
+        const char *t = (const char *)memchr(r->comment, '\t', e ? (size_t)(e - r->comment) : r->comment_l);
+        if (t) { e = t; }
+        if (!e) { e = r->comment + r->comment_l; }
+
+        int res = SB_DEMUX_UNMATCHED;
+        r->bc = (size_t)(e - r->comment) > l && e[-l-1] == ':' ? lookup(d, e - l, &res) : -1;
+        counts[res]++;
+    }
+
+    for (i = 0; i < SB_DEMUX_N; i++) { __atomic_fetch_add(&d->counts[i], counts[i], __ATOMIC_RELAXED); }
+}
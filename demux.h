@@ -0,0 +1,75 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2022-2023 Jacob Morrison <jacob.morrison@vai.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef DEMUX_H
+#define DEMUX_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "batch.h"
+
+#define SB_DEMUX_MAX_INDEX 31 /* longest index (not counting the '+' between dual indexes) */
+
+// Outcome of looking up a read's index
+enum {
+    SB_DEMUX_EXACT,     /* index matched exactly */
+    SB_DEMUX_MISMATCH,  /* index matched with one mismatch */
+    SB_DEMUX_UNMATCHED, /* no index matched, or more than one did */
+    SB_DEMUX_N
+};
+
+// Slot of the index hash table
+typedef struct {
+    uint64_t key;  /* 2-bit packed index, SB_DEMUX_EMPTY if the slot is free */
+    int32_t  bc;   /* barcode of the index, -1 if two indexes are one mismatch away from key */
+    int32_t  dist; /* mismatches between key and the index */
+} sb_demux_slot_t;
+
+// Index to barcode table, read-only once loaded apart from the counts
+struct sb_demux_s {
+    char            *text;       /* contents of the index file, which bcs point into */
+    int32_t          n_bcs;      /* number of indexes (and barcodes) */
+    char           **bcs;        /* barcode for each index */
+    size_t          *bc_lens;    /* length of each barcode */
+    size_t           max_bc_len; /* length of longest barcode */
+    int32_t          idx_len;    /* length of every index, including any '+' */
+    int32_t          sep;        /* position of the '+' between dual indexes, -1 for single indexes */
+    int32_t          mismatch;   /* allow one mismatch */
+    uint32_t         bits;       /* log2 of the number of table slots */
+    sb_demux_slot_t *slots;      /* open addressing table with linear probing */
+    uint64_t         counts[SB_DEMUX_N]; /* reads with each outcome */
+};
+
+// Load a tab-separated file of index and barcode pairs, one per line. Dual indexes are written as i7+i5, as in the
+// read comment. With mismatch, every sequence one base away from an index is added to the table as well, so
+// lookups stay a single probe; sequences one base away from two indexes match neither
+// Returns NULL if the file could not be read or has an invalid line
+sb_demux_t *sb_demux_load(const char *fn, int mismatch);
+void sb_demux_destroy(sb_demux_t *d);
+
+// Set the barcode (r->bc) of every read in the batch from the index at the end of its comment
+// (e.g. 1:N:0:ACGTACGT), -1 for reads that didn't match, and add the outcomes to d->counts
+void sb_demux_assign(sb_demux_t *d, sb_batch_t *b);
+
+#endif /* DEMUX_H */
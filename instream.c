@@ -0,0 +1,475 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2022-2023 Jacob Morrison <jacob.morrison@vai.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+// For F_SETPIPE_SZ
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "instream.h"
+#include "queue.h"
+#include "bgzf.h"
+#include "decomp.h"
+#include "kstring.h"
+#include "uring.h"
+
+#define SB_CHUNK_SIZE        (1 << 20) /* bytes decompressed at once by the gzip thread */
+#define SB_BLOCKS_PER_CHUNK  64        /* BGZF blocks inflated at once by a worker */
+#define SB_CHUNKS_PER_THREAD 4         /* chunks in flight per decompression thread */
+#define SB_PIPE_CHUNKS       16        /* chunks read ahead of the parser from a pipe */
+#define SB_PIPE_SIZE         (1 << 22) /* largest kernel buffer asked for on an input pipe */
+
+// How the input is decompressed
+enum {
+    SB_IN_SERIAL, /* streamed on the calling thread */
+    SB_IN_GZIP,   /* streamed on a dedicated thread */
+    SB_IN_BGZF,   /* blocks inflated in parallel, or on the calling thread without worker threads */
+    SB_IN_MAP     /* uncompressed file mapped into memory */
+};
+
+// A run of decompressed input
+typedef struct {
+    uint64_t   idx;  /* position of chunk in the input */
+    int32_t    err;  /* chunk could not be read or decompressed */
+    kstring_t  raw;  /* compressed BGZF blocks */
+    kstring_t  data; /* decompressed bytes */
+    size_t     pos;  /* number of bytes already handed out */
+} sb_chunk_t;
+
+struct sb_instream_s {
+    int32_t       mode;      /* SB_IN_SERIAL, SB_IN_GZIP, SB_IN_BGZF, or SB_IN_MAP */
+    int32_t       backend;   /* inflate library */
+    sb_gzin_t    *gz;        /* streamed input (serial and gzip modes) */
+    FILE         *fp;        /* raw file handle (BGZF mode) */
+    sb_decomp_t  *dec;       /* block inflater for BGZF mode on the calling thread */
+    int32_t       n_chunks;  /* number of chunks in flight */
+    sb_chunk_t   *chunks;    /* all allocated chunks */
+    sb_chunk_t   *cur;       /* chunk currently being handed out */
+    sb_queue_t    free_q;    /* chunks ready to be filled */
+    sb_queue_t    work_q;    /* chunks of compressed blocks ready to be inflated */
+    sb_reorder_t  done;      /* decompressed chunks in input order */
+    int32_t       n_workers; /* number of inflating threads */
+    pthread_t    *workers;   /* inflating threads */
+    pthread_t     reader;    /* thread reading (and for gzip, decompressing) the file */
+    int32_t       started;   /* threads have been started */
+    char         *map;       /* mapped file (map mode) */
+    size_t        map_l;     /* length of mapped file */
+    size_t        map_pos;   /* number of mapped bytes already handed out */
+    sb_stats_t   *st;        /* run counters (may be NULL) */
+};
+
+// Read exactly len bytes
+// Returns 0 on success, 1 at end of file before any bytes are read, -1 on a short read or error
+static int read_exact(FILE *fp, void *buf, size_t len) {
+    size_t n = fread(buf, 1, len, fp);
+    if (n == len) { return 0; }
+
+    return (n == 0 && feof(fp)) ? 1 : -1;
+}
+
+// Read up to SB_BLOCKS_PER_CHUNK BGZF blocks into c->raw, stopping early (with c->err set) at a truncated or malformed
+// block, so the blocks before it are still inflated. A gzip member that isn't BGZF (e.g. from a plain gzip file
+// concatenated onto a BGZF one) also stops the chunk, and the rest of the file is streamed from s->gz instead
+// Returns the number of whole blocks read
+static int read_blocks(sb_instream_t *s, sb_chunk_t *c) {
+    FILE *fp = s->fp;
+    int   n_blocks;
+    for (n_blocks = 0; n_blocks < SB_BLOCKS_PER_CHUNK; n_blocks++) {
+        if (ks_resize(&c->raw, c->raw.l + SB_BGZF_MAX_BLOCK) < 0) {
+            c->err = 1;
+            break;
+        }
+
+        uint8_t *hdr = (uint8_t *)c->raw.s + c->raw.l;
+        int ret = read_exact(fp, hdr, SB_BGZF_HDR_SIZE);
+        if (ret == 1) { break; }
+
+        int size = ret < 0 ? -1 : sb_bgzf_block_size(hdr, SB_BGZF_HDR_SIZE);
+        if (size < 0 && ret == 0 && hdr[0] == 0x1f && hdr[1] == 0x8b) {
+            // The stream reader takes over fp, starting from the header already read
+            s->gz = sb_gzin_fopen(fp, hdr, SB_BGZF_HDR_SIZE);
+            s->fp = NULL;
+            if (!s->gz) { c->err = 1; }
+            break;
+        }
+        if (size < SB_BGZF_HDR_SIZE + 8 || read_exact(fp, hdr + SB_BGZF_HDR_SIZE, size - SB_BGZF_HDR_SIZE) != 0) {
+            c->err = 1;
+            break;
+        }
+        c->raw.l += size;
+    }
+
+    return n_blocks;
+}
+
+// Decompress s->gz into chunks ahead of the parser, the first numbered idx
+// Returns the number of chunks put in order
+static uint64_t stream_chunks(sb_instream_t *s, uint64_t idx) {
+    sb_chunk_t *c;
+    while ((c = (sb_chunk_t *)sb_queue_pop(&s->free_q)) != NULL) {
+        c->idx    = idx;
+        c->err    = 0;
+        c->data.l = 0;
+        c->pos    = 0;
+
+        if (ks_resize(&c->data, SB_CHUNK_SIZE) < 0) {
+            c->err = 1;
+        } else {
+            // A short read is the end of the file, unless an error is reported (e.g. a truncated file). The bytes read
+            // before an error are still handed out ahead of it
+            uint64_t t   = sb_time_ns();
+            int      n   = sb_gzin_read(s->gz, c->data.s, SB_CHUNK_SIZE);
+            int      err = n < SB_CHUNK_SIZE ? sb_gzin_error(s->gz) : 0;
+            SB_STATS_ADD(s->st, inflate_ns, sb_time_ns() - t);
+            if (n > 0) { c->data.l = n; }
+            if (n < 0 || err) {
+                c->err = 1;
+            } else if (n == 0) {
+                break;
+            }
+        }
+
+        sb_reorder_put(&s->done, idx++, c);
+        if (c->err || c->data.l < SB_CHUNK_SIZE) { break; }
+    }
+
+    return idx;
+}
+
+// Decompress non-BGZF input ahead of the parser
+static void *gzip_reader_thread(void *data) {
+    sb_instream_t *s = (sb_instream_t *)data;
+    sb_reorder_finish(&s->done, stream_chunks(s, 0));
+
+    return NULL;
+}
+
+// Read compressed blocks and pass them to the inflating threads
+static void *bgzf_reader_thread(void *data) {
+    sb_instream_t *s   = (sb_instream_t *)data;
+    uint64_t       idx = 0;
+
+    sb_chunk_t *c;
+    while ((c = (sb_chunk_t *)sb_queue_pop(&s->free_q)) != NULL) {
+        c->idx    = idx;
+        c->err    = 0;
+        c->raw.l  = 0;
+        c->data.l = 0;
+        c->pos    = 0;
+
+        // A chunk that stopped at a bad block is still inflated, and hands the error to the parser after its data
+        int n = read_blocks(s, c);
+        if (n == 0 && !c->err && !s->gz) { break; }
+
+        idx++;
+        if (sb_queue_push(&s->work_q, c) < 0 || c->err) { break; }
+        if (s->gz) {
+            // The rest of the file is decompressed as a stream, in chunks numbered on from the blocks before it
+            idx = stream_chunks(s, idx);
+            break;
+        }
+    }
+
+    sb_reorder_finish(&s->done, idx);
+    sb_queue_close(&s->work_q);
+
+    return NULL;
+}
+
+// Inflate the blocks in c->raw into c->data, up to the first corrupt one
+static void inflate_chunk(sb_decomp_t *d, sb_chunk_t *c) {
+    size_t off = 0;
+    while (off < c->raw.l) {
+        const uint8_t *blk  = (const uint8_t *)c->raw.s + off;
+        int            size = sb_bgzf_block_size(blk, c->raw.l - off);
+        if (!d || size < 0 || sb_bgzf_decompress(d, &c->data, blk, size) < 0) {
+            c->err = 1;
+            break;
+        }
+        off += size;
+    }
+}
+
+static void *bgzf_worker_thread(void *data) {
+    sb_instream_t *s = (sb_instream_t *)data;
+    sb_decomp_t   *d = sb_decomp_init(s->backend);
+
+    sb_chunk_t *c;
+    while ((c = (sb_chunk_t *)sb_queue_pop(&s->work_q)) != NULL) {
+        uint64_t t = sb_time_ns();
+        inflate_chunk(d, c);
+        SB_STATS_ADD(s->st, inflate_ns, sb_time_ns() - t);
+        sb_reorder_put(&s->done, c->idx, c);
+    }
+    sb_decomp_destroy(d);
+
+    return NULL;
+}
+
+// Allocate n_chunks chunks and start the decompression threads
+static int start_threads(sb_instream_t *s, int32_t n_workers, int32_t n_chunks) {
+    int32_t i;
+
+    s->n_workers = n_workers;
+    s->n_chunks  = n_chunks;
+    s->chunks    = (sb_chunk_t *)calloc(s->n_chunks, sizeof(sb_chunk_t));
+    s->workers   = (pthread_t *)calloc(n_workers > 0 ? n_workers : 1, sizeof(pthread_t));
+    if (!s->chunks || !s->workers || sb_queue_init(&s->free_q, s->n_chunks) < 0 ||
+            sb_queue_init(&s->work_q, s->n_chunks) < 0 || sb_reorder_init(&s->done, s->n_chunks) < 0) {
+        return -1;
+    }
+    for (i = 0; i < s->n_chunks; i++) { sb_queue_push(&s->free_q, &s->chunks[i]); }
+
+    if (s->mode == SB_IN_BGZF) {
+        pthread_create(&s->reader, NULL, bgzf_reader_thread, s);
+        for (i = 0; i < n_workers; i++) { pthread_create(&s->workers[i], NULL, bgzf_worker_thread, s); }
+    } else {
+        pthread_create(&s->reader, NULL, gzip_reader_thread, s);
+    }
+    s->started = 1;
+
+    return 0;
+}
+
+// Map an uncompressed regular file into memory, read ahead by the kernel as it is parsed
+// Returns 0 on success, -1 if the file could not be mapped
+static int map_file(sb_instream_t *s, off_t size) {
+    if (size == 0) { return 0; }
+
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileno(s->fp), 0);
+    if (map == MAP_FAILED) { return -1; }
+    madvise(map, size, MADV_SEQUENTIAL);
+
+    s->map   = (char *)map;
+    s->map_l = size;
+
+    return 0;
+}
+
+// Enlarge the kernel buffer of a pipe, so the program writing into it can run further ahead while the input is parsed.
+// Without privileges, a pipe can only grow to /proc/sys/fs/pipe-max-size (1M by default), so smaller sizes are tried
+// until one is allowed, and the pipe is left as it is if none are
+static void grow_pipe(int fd) {
+#ifdef F_SETPIPE_SZ
+    int size;
+    for (size = SB_PIPE_SIZE; size > 65536; size >>= 1) {
+        if (fcntl(fd, F_SETPIPE_SZ, size) >= 0) { break; }
+    }
+#else
+    (void)fd;
+#endif
+}
+
+// Read a regular file from its start through io_uring, with reads in flight ahead of the caller
+// Returns the stream, NULL if io_uring isn't available
+static FILE *uring_open(int fd) {
+    int dfd = dup(fd);
+    if (dfd < 0) { return NULL; }
+
+    FILE *fp = sb_uring_fopen(dfd, 0);
+    if (!fp) { close(dfd); }
+
+    return fp;
+}
+
+sb_instream_t *sb_instream_open(const char *fn, int32_t n_threads, int32_t backend, int32_t io, sb_stats_t *stats) {
+    sb_instream_t *s = (sb_instream_t *)calloc(1, sizeof(sb_instream_t));
+    if (!s) { return NULL; }
+    s->st = stats;
+
+    // Peek at the first block to find BGZF input, only regular files can be rewound after peeking. fn is - for stdin,
+    // which is a regular file when redirected from one
+    s->backend = backend;
+    int fd     = sb_open_input(fn);
+    if (fd < 0 || (s->fp = fdopen(fd, "rb")) == NULL) {
+        if (fd >= 0) { close(fd); }
+        free(s);
+        return NULL;
+    }
+
+    struct stat st;
+    uint8_t     hdr[SB_BGZF_HDR_SIZE];
+    size_t      n       = 0;
+    int         has_st  = fstat(fd, &st) == 0;
+    int         is_reg  = has_st && S_ISREG(st.st_mode);
+    int         is_pipe = has_st && S_ISFIFO(st.st_mode);
+    if (is_reg) { n = fread(hdr, 1, SB_BGZF_HDR_SIZE, s->fp); }
+    if (is_pipe) { grow_pipe(fd); }
+
+    if (sb_bgzf_block_size(hdr, n) > 0 && fseek(s->fp, 0, SEEK_SET) == 0) {
+        s->mode = SB_IN_BGZF;
+
+        FILE *u = io == SB_IO_URING ? uring_open(fd) : NULL;
+        if (u) {
+            fclose(s->fp);
+            s->fp = u;
+        }
+    } else if (is_reg && !(n >= 2 && hdr[0] == 0x1f && hdr[1] == 0x8b) && map_file(s, st.st_size) == 0) {
+        s->mode = SB_IN_MAP;
+        fclose(s->fp);
+        s->fp = NULL;
+    } else {
+        // Rewind what was peeked at, which stdin shares with the stream opened below. A pipe is drained on its own
+        // thread even without -@, so the program writing into it doesn't wait on the parser, as long as there is a
+        // spare CPU to run it on
+        if (is_reg) { fseek(s->fp, 0, SEEK_SET); }
+        FILE *u = is_reg && io == SB_IO_URING ? uring_open(fd) : NULL;
+        fclose(s->fp);
+        s->fp   = NULL;
+        s->mode = n_threads > 1 || (is_pipe && sysconf(_SC_NPROCESSORS_ONLN) > 1) ? SB_IN_GZIP : SB_IN_SERIAL;
+
+        s->gz = u ? sb_gzin_fopen(u, NULL, 0) : sb_gzin_open(fn);
+        if (!s->gz) {
+            free(s);
+            return NULL;
+        }
+    }
+
+    int ret = 0;
+    if (s->mode == SB_IN_BGZF && n_threads <= 1) {
+        // Blocks are inflated one chunk at a time as the parser needs them
+        s->n_chunks = 1;
+        s->chunks   = (sb_chunk_t *)calloc(1, sizeof(sb_chunk_t));
+        s->dec      = sb_decomp_init(backend);
+        if (!s->chunks || !s->dec) { ret = -1; }
+    } else if (s->mode == SB_IN_GZIP || s->mode == SB_IN_BGZF) {
+        int32_t n_workers = s->mode == SB_IN_BGZF ? n_threads : 0;
+        int32_t n_chunks  = (n_workers > 0 ? n_workers : 1) * SB_CHUNKS_PER_THREAD;
+        ret = start_threads(s, n_workers, is_pipe && n_chunks < SB_PIPE_CHUNKS ? SB_PIPE_CHUNKS : n_chunks);
+    }
+    if (ret < 0) {
+        sb_instream_close(s);
+        return NULL;
+    }
+
+    return s;
+}
+
+void sb_instream_close(sb_instream_t *s) {
+    if (!s) { return; }
+
+    int32_t i;
+    if (s->started) {
+        // Wake any thread still waiting on a queue, the parser may stop before the end of the file
+        sb_queue_close(&s->free_q);
+        sb_queue_close(&s->work_q);
+        sb_reorder_close(&s->done);
+        pthread_join(s->reader, NULL);
+        for (i = 0; i < s->n_workers; i++) { pthread_join(s->workers[i], NULL); }
+    }
+    if (s->chunks) {
+        for (i = 0; i < s->n_chunks; i++) {
+            free(s->chunks[i].raw.s);
+            free(s->chunks[i].data.s);
+        }
+    }
+    free(s->chunks);
+    free(s->workers);
+    sb_queue_destroy(&s->free_q);
+    sb_queue_destroy(&s->work_q);
+    sb_reorder_destroy(&s->done);
+
+    if (s->map) { munmap(s->map, s->map_l); }
+    sb_decomp_destroy(s->dec);
+    sb_gzin_close(s->gz);
+    if (s->fp) { fclose(s->fp); }
+    free(s);
+}
+
+// Read and inflate the next chunk of blocks on the calling thread
+// Returns the chunk, NULL at end of file
+static sb_chunk_t *next_serial_chunk(sb_instream_t *s) {
+    sb_chunk_t *c = s->chunks;
+
+    c->err    = 0;
+    c->raw.l  = 0;
+    c->data.l = 0;
+    c->pos    = 0;
+
+    int n = read_blocks(s, c);
+    if (n == 0 && !c->err && !s->gz) { return NULL; }
+
+    uint64_t t = sb_time_ns();
+    inflate_chunk(s->dec, c);
+    SB_STATS_ADD(s->st, inflate_ns, sb_time_ns() - t);
+
+    return c;
+}
+
+int sb_instream_read(sb_instream_t *s, void *buf, int len) {
+    if (s->mode == SB_IN_SERIAL) {
+        uint64_t t = sb_time_ns();
+        int      n = sb_gzin_read(s->gz, buf, len);
+        SB_STATS_ADD(s->st, inflate_ns, sb_time_ns() - t);
+        return n;
+    }
+    if (s->mode == SB_IN_MAP) {
+        size_t n = s->map_l - s->map_pos;
+        if (n > (size_t)len) { n = (size_t)len; }
+        memcpy(buf, s->map + s->map_pos, n);
+        s->map_pos += n;
+        return (int)n;
+    }
+
+    // Move on to the next chunk once the current one is used up
+    while (!s->cur || s->cur->pos == s->cur->data.l) {
+        if (s->cur) {
+            if (s->cur->err) { return -1; }
+            if (s->started) { sb_queue_push(&s->free_q, s->cur); }
+        }
+        if (!s->started && s->gz) {
+            // Blocks read on the calling thread ran up to a gzip member that isn't BGZF, stream the rest
+            s->mode = SB_IN_SERIAL;
+            return sb_instream_read(s, buf, len);
+        }
+        s->cur = s->started ? (sb_chunk_t *)sb_reorder_take(&s->done) : next_serial_chunk(s);
+        if (!s->cur) { return 0; }
+    }
+
+    size_t n = s->cur->data.l - s->cur->pos;
+    if (n > (size_t)len) { n = (size_t)len; }
+    memcpy(buf, s->cur->data.s + s->cur->pos, n);
+    s->cur->pos += n;
+
+    return (int)n;
+}
+
+const char *sb_instream_mapped(sb_instream_t *s, size_t *len) {
+    if (s->mode != SB_IN_MAP) { return NULL; }
+
+    *len = s->map_l;
+    return s->map ? s->map : "";
+}
+
+int sb_instream_error(sb_instream_t *s) {
+    if (s->mode == SB_IN_SERIAL) { return sb_gzin_error(s->gz); }
+
+    return s->cur && s->cur->err;
+}
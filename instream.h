@@ -0,0 +1,58 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2022-2023 Jacob Morrison <jacob.morrison@vai.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef INSTREAM_H
+#define INSTREAM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "stats.h"
+
+// Decompressed bytes of an input file, opaque to callers
+typedef struct sb_instream_s sb_instream_t;
+
+// Open fn (- for stdin) for reading, uncompressed and gzip compressed files are both handled
+// Uncompressed regular files are mapped into memory, see sb_instream_mapped()
+// BGZF files are inflated block by block with the chosen backend (see decomp.h). With n_threads > 1, BGZF blocks are
+// inflated on n_threads threads and other files are decompressed on a dedicated thread, so decompression overlaps
+// with parsing. A gzip member that isn't BGZF after BGZF blocks is streamed on, along with the rest of the file
+// Pipes have their buffer enlarged and are always read (and decompressed) ahead of the parser on a dedicated thread
+// With io SB_IO_URING, compressed regular files are read with several large reads in flight on an io_uring (when
+// available), so the disk works while blocks are inflated and parsed
+// Time spent decompressing is added to stats (if not NULL)
+// Returns NULL if the file could not be opened
+sb_instream_t *sb_instream_open(const char *fn, int32_t n_threads, int32_t backend, int32_t io, sb_stats_t *stats);
+void sb_instream_close(sb_instream_t *s);
+
+// Copy up to len decompressed bytes into buf
+// Returns the number of bytes copied, 0 at end of file, -1 on error
+int sb_instream_read(sb_instream_t *s, void *buf, int len);
+
+// Returns the whole file if it was mapped into memory, storing its length in len, NULL if the file is streamed
+const char *sb_instream_mapped(sb_instream_t *s, size_t *len);
+
+// Returns 1 if reading stopped because of a read or decompression error, 0 otherwise
+int sb_instream_error(sb_instream_t *s);
+
+#endif /* INSTREAM_H */
@@ -0,0 +1,289 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2022-2023 Jacob Morrison <jacob.morrison@vai.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "libsynthbar.h"
+#include "record.h"
+#include "parse.h"
+#include "bgzf.h"
+#include "demux.h"
+#include "linker.h"
+#include "trim.h"
+#include "bam.h"
+#include "decomp.h"
+#include "reader.h"
+#include "writer.h"
+
+#define SB_CTX_PIECE 4096 /* first bytes of a push added to a record carried over from the last push */
+
+struct sb_ctx_s {
+    sb_conf_t    conf;             /* copy of the caller's configuration */
+    sb_builder_t bd;               /* read rewriting pieces */
+    sb_batch_t  *b;                /* reads being rewritten, out and miss gather the output of a whole call */
+    sb_parser_t  ps;               /* storage for records that can't be parsed in place */
+    sb_bgzf_t   *z;                /* compressor (compressed output only) */
+    kstring_t    carry;            /* pushed bytes of a record not complete yet */
+    uint64_t     n_reads;          /* number of reads rewritten */
+    int32_t      started;          /* output of the current stream has begun (BAM header written) */
+    int32_t      err;              /* a call has failed */
+    char         msg[SB_ERR_MSG];  /* description of the error */
+};
+
+sb_conf_t sb_conf_init() {
+    sb_conf_t conf = {0};
+
+    conf.outfn         = (char *)"-";
+    conf.mate_outfn    = NULL;
+    conf.barcode       = (char *)"CATATAC";
+    conf.umi_first     = 0;
+    conf.remove_linker = 0;
+    conf.linker_length = 6;
+    conf.umi_length    = 8;
+    conf.check_names   = 0;
+    conf.n_threads     = 1;
+    conf.out_bufsize   = SB_WRITER_BUFSIZE;
+    conf.compress      = 0;
+    conf.level         = 6;
+    conf.inflate       = SB_INFLATE_AUTO;
+    conf.io            = SB_IO_SYNC;
+    conf.in_bufsize    = SB_READER_BUFSIZE;
+    conf.huge_pages    = 0;
+
+    return conf;
+}
+
+sb_ctx_t *sb_ctx_init(const sb_conf_t *conf) {
+    sb_ctx_t *ctx = (sb_ctx_t *)calloc(1, sizeof(sb_ctx_t));
+    if (!ctx) { return NULL; }
+
+    // BAM is always BGZF compressed
+    ctx->conf           = *conf;
+    ctx->conf.stats     = NULL;
+    ctx->conf.umi_stats = NULL;
+    if (conf->bam) { ctx->conf.compress = 1; }
+    if (sb_builder_init(&ctx->bd, &ctx->conf) < 0) {
+        free(ctx);
+        return NULL;
+    }
+    if ((ctx->b = sb_batch_init(conf->huge_pages)) == NULL ||
+            (ctx->conf.compress && (ctx->z = sb_bgzf_init(conf->level)) == NULL)) {
+        sb_ctx_destroy(ctx);
+        return NULL;
+    }
+
+    return ctx;
+}
+
+void sb_ctx_destroy(sb_ctx_t *ctx) {
+    if (!ctx) { return; }
+
+    sb_builder_destroy(&ctx->bd);
+    sb_batch_destroy(ctx->b);
+    sb_parser_destroy(&ctx->ps);
+    sb_bgzf_destroy(ctx->z);
+    free(ctx->carry.s);
+    free(ctx);
+}
+
+// Record an error, later calls fail without doing anything
+// Returns -1
+static int fail(sb_ctx_t *ctx, const char *msg) {
+    if (msg != ctx->msg) { snprintf(ctx->msg, sizeof(ctx->msg), "%s", msg); }
+    ctx->err = 1;
+
+    return -1;
+}
+
+// Clear the output of the last call, starting a new BAM stream with its header
+// Returns 0 on success, -1 on error or if an earlier call failed
+static int start_call(sb_ctx_t *ctx) {
+    sb_batch_reset(ctx->b);
+    if (ctx->err) { return -1; }
+
+    if (ctx->conf.bam && !ctx->started && sb_bam_header(&ctx->b->gz, ctx->conf.level) < 0) {
+        return fail(ctx, "Unable to compress BAM header");
+    }
+    ctx->started = 1;
+
+    return 0;
+}
+
+// Compress the output of the call, ending it with an end-of-file block if eof is set
+// Returns ret, or -1 if the output could not be compressed
+static int end_call(sb_ctx_t *ctx, int ret, int eof) {
+    sb_batch_t *b = ctx->b;
+    if (!ctx->z) { return ret; }
+
+    int miss = ctx->conf.demux || ctx->conf.linker;
+    if (sb_bgzf_compress(ctx->z, &b->gz, b->out.s, b->out.l) < 0 ||
+            (b->miss.l && sb_bgzf_compress(ctx->z, &b->miss_gz, b->miss.s, b->miss.l) < 0) ||
+            (eof && (kputsn_(SB_BGZF_EOF, SB_BGZF_EOF_SIZE, &b->gz) < 0 ||
+                     (miss && kputsn_(SB_BGZF_EOF, SB_BGZF_EOF_SIZE, &b->miss_gz) < 0)))) {
+        b->gz.l = b->miss_gz.l = 0;
+        return fail(ctx, "Unable to compress output");
+    }
+
+    return ret;
+}
+
+// Rewrite the reads in the batch, adding them to the output of the call
+// Returns 0 on success, -1 on error
+static int run_batch(sb_ctx_t *ctx) {
+    sb_batch_t *b = ctx->b;
+
+    if (ctx->conf.demux) { sb_demux_assign(ctx->conf.demux, b); }
+    if (ctx->conf.linker) { sb_linker_check(ctx->conf.linker, &ctx->bd, b); }
+    if (ctx->conf.trim) { sb_trim_apply(ctx->conf.trim, &ctx->bd, ctx->conf.linker, b); }
+    if (sb_batch_process(&ctx->bd, b) != SB_OK) {
+        ctx->n_reads += b->err;
+        return fail(ctx, sb_batch_error(&ctx->conf, b, ctx->msg, sizeof(ctx->msg)));
+    }
+    ctx->n_reads += b->n;
+
+    // Start the next batch, keeping the output
+    b->n      = 0;
+    b->data.l = 0;
+
+    return 0;
+}
+
+// Parse and rewrite the records in [*p, end) a batch at a time, eof is 1 if end is the end of the input
+// Returns 0 once every complete record is rewritten (*p is moved past them), -1 on error
+static int parse_run(sb_ctx_t *ctx, const char **p, const char *end, int eof) {
+    sb_batch_t *b = ctx->b;
+    int         ret;
+
+    do {
+        ret = sb_parse_batch(&ctx->ps, b, SB_BATCH_RECS, p, end, eof);
+        sb_batch_finalize(b);
+        if (b->n > 0 && run_batch(ctx) < 0) { return -1; }
+    } while (ret == SB_PARSE_OK);
+
+    switch (ret) {
+        case SB_PARSE_MORE:
+        case SB_PARSE_EOF:
+            return 0;
+        case SB_PARSE_MEM:
+            return fail(ctx, "Unable to reallocate sufficient space");
+        default:
+            snprintf(ctx->msg, sizeof(ctx->msg), "Quality string length does not match sequence length (read %"
+                    PRIu64 ")", ctx->n_reads + 1);
+            return fail(ctx, ctx->msg);
+    }
+}
+
+int sb_ctx_push(sb_ctx_t *ctx, const char *data, size_t len) {
+    if (start_call(ctx) < 0) { return -1; }
+
+    const char *p     = data;
+    const char *end   = data + len;
+    size_t      piece = SB_CTX_PIECE;
+
+    // Finish the record carried over from the last push, adding the new bytes a growing piece at a time, so usually
+    // only the start of data is copied
+    while (ctx->carry.l > 0 && p < end) {
+        size_t n    = (size_t)(end - p) < piece ? (size_t)(end - p) : piece;
+        size_t orig = ctx->carry.l;
+        if (kputsn_(p, n, &ctx->carry) < 0) {
+            return end_call(ctx, fail(ctx, "Unable to reallocate sufficient space"), 0);
+        }
+        p     += n;
+        piece <<= 1;
+
+        const char *q = ctx->carry.s;
+        if (parse_run(ctx, &q, ctx->carry.s + ctx->carry.l, 0) < 0) { return end_call(ctx, -1, 0); }
+
+        size_t used = q - ctx->carry.s;
+        if (used >= orig) {
+            // Past the carried bytes, the rest is parsed straight from data
+            p            -= ctx->carry.l - used;
+            ctx->carry.l  = 0;
+        } else {
+            memmove(ctx->carry.s, q, ctx->carry.l - used);
+            ctx->carry.l -= used;
+        }
+    }
+
+    if (ctx->carry.l == 0 && p < end) {
+        if (parse_run(ctx, &p, end, 0) < 0) { return end_call(ctx, -1, 0); }
+        if (p < end && kputsn_(p, end - p, &ctx->carry) < 0) {
+            return end_call(ctx, fail(ctx, "Unable to reallocate sufficient space"), 0);
+        }
+    }
+
+    return end_call(ctx, 0, 0);
+}
+
+int sb_ctx_finish(sb_ctx_t *ctx) {
+    if (start_call(ctx) < 0) { return -1; }
+
+    const char *q   = ctx->carry.s;
+    int         ret = 0;
+    if (ctx->carry.l > 0) {
+        ret = parse_run(ctx, &q, ctx->carry.s + ctx->carry.l, 1);
+        ctx->carry.l = 0;
+    }
+    ctx->started = 0;
+
+    return end_call(ctx, ret, 1);
+}
+
+int sb_ctx_process(sb_ctx_t *ctx, const sb_rec_t *recs, int32_t n) {
+    if (start_call(ctx) < 0) { return -1; }
+
+    sb_batch_t *b = ctx->b;
+    int32_t     i;
+    for (i = 0; i < n; i += SB_BATCH_RECS) {
+        b->n = n - i < SB_BATCH_RECS ? n - i : SB_BATCH_RECS;
+        memcpy(b->recs, recs + i, b->n * sizeof(sb_rec_t));
+        if (run_batch(ctx) < 0) { return end_call(ctx, -1, 0); }
+    }
+
+    return end_call(ctx, 0, 0);
+}
+
+const char *sb_ctx_output(const sb_ctx_t *ctx, size_t *len) {
+    const kstring_t *out = ctx->z ? &ctx->b->gz : &ctx->b->out;
+    *len = out->l;
+
+    return out->s ? out->s : "";
+}
+
+const char *sb_ctx_unmatched(const sb_ctx_t *ctx, size_t *len) {
+    const kstring_t *miss = ctx->z ? &ctx->b->miss_gz : &ctx->b->miss;
+    *len = miss->l;
+
+    return miss->s ? miss->s : "";
+}
+
+uint64_t sb_ctx_n_reads(const sb_ctx_t *ctx) {
+    return ctx->n_reads;
+}
+
+const char *sb_ctx_error(const sb_ctx_t *ctx) {
+    return ctx->err ? ctx->msg : "";
+}
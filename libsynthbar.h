@@ -0,0 +1,104 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2022-2023 Jacob Morrison <jacob.morrison@vai.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef LIBSYNTHBAR_H
+#define LIBSYNTHBAR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "synthbar.h"
+#include "batch.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// In-process rewriting of reads, as done by the synthbar command line (built as libsynthbar.a and libsynthbar.so)
+//
+// A context holds everything needed to rewrite one stream of reads and nothing is shared between contexts, so any
+// number of them can run at once, each on one thread at a time. Context functions never print or touch files,
+// errors are returned and described by sb_ctx_error(). Reads are rewritten straight from the caller's buffers, only
+// a record split across two sb_ctx_push() calls is copied
+//
+//     sb_conf_t conf = sb_conf_init();
+//     conf.remove_linker = 1;
+//     sb_ctx_t *ctx = sb_ctx_init(&conf);
+//     while ((len = next_chunk(&buf)) > 0) {
+//         if (sb_ctx_push(ctx, buf, len) < 0) { handle(sb_ctx_error(ctx)); }
+//         out = sb_ctx_output(ctx, &out_len);
+//     }
+//     sb_ctx_finish(ctx);
+//     out = sb_ctx_output(ctx, &out_len);
+//     sb_ctx_destroy(ctx);
+
+typedef struct sb_ctx_s sb_ctx_t;
+
+// Default configuration, the same as the command line without any options
+sb_conf_t sb_conf_init();
+
+// Create a context rewriting reads as set by conf (n_threads, stats, umi_stats, and output file options are not
+// used). conf is copied, but a demux table, read structure, linker, or trimming it points to must outlive the context
+// and may be shared between contexts
+// Returns NULL if memory could not be allocated or conf->linker or conf->trim doesn't fit the read layout
+sb_ctx_t *sb_ctx_init(const sb_conf_t *conf);
+void sb_ctx_destroy(sb_ctx_t *ctx);
+
+// Rewrite the complete FASTQ records in len bytes of data, which can start or end part way through a record. The
+// end of a record cut off by the end of data is kept until the next call
+// Returns 0 on success, -1 on error
+int sb_ctx_push(sb_ctx_t *ctx, const char *data, size_t len);
+
+// Mark the end of the pushed input, rewriting the last record, and end compressed output with a BGZF end-of-file
+// block. The context can then be used for a new stream
+// Returns 0 on success, -1 on error (including input ending part way through a record)
+int sb_ctx_finish(sb_ctx_t *ctx);
+
+// Rewrite n parsed records, which are not changed (bc and shift are ignored, they are set from the read comment
+// when demultiplexing and by the linker check, and trimming works on a copy)
+// Returns 0 on success, -1 on error
+int sb_ctx_process(sb_ctx_t *ctx, const sb_rec_t *recs, int32_t n);
+
+// Output of the last sb_ctx_push(), sb_ctx_finish(), or sb_ctx_process() call, BGZF compressed with conf->compress.
+// With conf->bam, the output of the first call of each stream starts with the BAM header
+// After an error it holds the reads before the failing one
+// Returns a buffer of *len bytes owned by the context, valid until the next call on the context
+const char *sb_ctx_output(const sb_ctx_t *ctx, size_t *len);
+
+// Reads of the last call whose index matched no barcode, or that failed the linker check (with conf->linker->keep),
+// unchanged
+// Returns a buffer of *len bytes owned by the context, valid until the next call on the context
+const char *sb_ctx_unmatched(const sb_ctx_t *ctx, size_t *len);
+
+// Returns the number of reads rewritten (or copied to the unmatched output) so far
+uint64_t sb_ctx_n_reads(const sb_ctx_t *ctx);
+
+// Once a call has failed, every later call fails too
+// Returns the message describing the error, an empty string if there was none
+const char *sb_ctx_error(const sb_ctx_t *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBSYNTHBAR_H */
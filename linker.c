@@ -0,0 +1,140 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2022-2023 Jacob Morrison <jacob.morrison@vai.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "linker.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define SB_LINKER_X86 1
+#include <immintrin.h>
+#endif
+
+int sb_linker_init(sb_linker_t *lk, const char *seq, int32_t max_mismatch, int32_t max_shift, int keep) {
+    memset(lk, 0, sizeof(sb_linker_t));
+
+    size_t l = strlen(seq);
+    if (l == 0 || l > SB_LINKER_MAX) {
+        fprintf(stderr, "Linker must be between 1 and %i bases long: %s\n", SB_LINKER_MAX, seq);
+        return -1;
+    }
+    if (max_mismatch < 0 || max_shift < 0 || max_shift > SB_LINKER_MAX_SHIFT) {
+        fprintf(stderr, "Linker mismatches (%i) must be >= 0 and shift (%i) between 0 and %i\n", max_mismatch,
+                max_shift, SB_LINKER_MAX_SHIFT);
+        return -1;
+    }
+
+    size_t i;
+    for (i = 0; i < l; i++) {
+        char c = (char)(seq[i] & ~0x20);
+        if (c != 'A' && c != 'C' && c != 'G' && c != 'T' && c != 'N') {
+            fprintf(stderr, "Linker can only have A, C, G, T, or N: %s\n", seq);
+            return -1;
+        }
+        lk->seq[i] = c;
+        if (c == 'N') { lk->any |= 1ULL << i; }
+    }
+
+    lk->len          = l;
+    lk->max_mismatch = max_mismatch;
+    lk->max_shift    = max_shift;
+    lk->keep         = keep;
+
+    return 0;
+}
+
+// Number of bases of the linker that differ from those at s (an N in the linker matches anything), avail bytes can
+// be read from s
+static inline int32_t mismatches(const sb_linker_t *lk, const char *s, size_t avail) {
+    int32_t n = 0;
+    size_t  i = 0;
+#ifdef SB_LINKER_X86
+    // 16 bases at a time, the last (partial) block is copied out unless 16 bytes can be read from the read
+    for (; i < lk->len; i += 16) {
+        __m128i v;
+        if (avail - i >= 16) {
+            v = _mm_loadu_si128((const __m128i *)(s + i));
+        } else {
+            char buf[16] = {0};
+            memcpy(buf, s + i, avail - i);
+            v = _mm_loadu_si128((const __m128i *)buf);
+        }
+        __m128i  e    = _mm_cmpeq_epi8(v, _mm_loadu_si128((const __m128i *)(lk->seq + i)));
+        uint32_t eq   = (uint32_t)_mm_movemask_epi8(e) | (uint32_t)(lk->any >> i);
+        uint32_t mask = lk->len - i >= 16 ? 0xffff : (1u << (lk->len - i)) - 1;
+        n += __builtin_popcount(~eq & mask);
+    }
+#else
+    for (; i < lk->len; i++) { n += s[i] != lk->seq[i] && lk->seq[i] != 'N'; }
+    (void)avail;
+#endif
+
+    return n;
+}
+
+void sb_linker_check(sb_linker_t *lk, const sb_builder_t *bd, sb_batch_t *b) {
+    uint64_t counts[SB_LINKER_N] = {0};
+    int32_t  fail = lk->keep ? SB_BC_NONE : SB_BC_DROP;
+    size_t   off  = bd->umi_len;
+
+    int32_t i;
+    for (i = 0; i < b->n; i++) {
+        sb_rec_t *r = &b->recs[i];
+        if (!bd->demux) {
+            r->bc = 0;
+        } else if (r->bc < 0) {
+            continue;
+        }
+
+        // Reads too short for the linker fail later on
+        r->shift = 0;
+        if (r->seq_l < off + lk->len) { continue; }
+        if (mismatches(lk, r->seq + off, r->seq_l - off) <= lk->max_mismatch) {
+            counts[SB_LINKER_PASS]++;
+            continue;
+        }
+
+        // Closest shift first, earlier before later
+        int32_t d;
+        for (d = 1; d <= lk->max_shift; d++) {
+            if (off >= (size_t)d && mismatches(lk, r->seq + off - d, r->seq_l - off + d) <= lk->max_mismatch) {
+                r->shift = -d;
+                break;
+            }
+            if (r->seq_l >= off + d + lk->len && mismatches(lk, r->seq + off + d, r->seq_l - off - d) <=
+                    lk->max_mismatch) {
+                r->shift = d;
+                break;
+            }
+        }
+        if (r->shift != 0) {
+            counts[SB_LINKER_SHIFTED]++;
+        } else {
+            counts[SB_LINKER_REJECTED]++;
+            r->bc = fail;
+        }
+    }
+
+    for (i = 0; i < SB_LINKER_N; i++) { __atomic_fetch_add(&lk->counts[i], counts[i], __ATOMIC_RELAXED); }
+}
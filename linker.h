@@ -0,0 +1,65 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2022-2023 Jacob Morrison <jacob.morrison@vai.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef LINKER_H
+#define LINKER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "batch.h"
+#include "record.h"
+
+#define SB_LINKER_MAX       64 /* longest linker that can be checked */
+#define SB_LINKER_MAX_SHIFT 2  /* furthest a linker can be found from where it is expected */
+
+// Outcome of checking a read's linker
+enum {
+    SB_LINKER_PASS,     /* linker found where expected */
+    SB_LINKER_SHIFTED,  /* linker found up to max_shift bases away */
+    SB_LINKER_REJECTED, /* linker not found */
+    SB_LINKER_N
+};
+
+// Expected linker, read-only once set up apart from the counts
+struct sb_linker_s {
+    char     seq[SB_LINKER_MAX];  /* expected linker (upper case), zero padded */
+    size_t   len;                 /* length of the linker */
+    uint64_t any;                 /* bit i set if base i of the linker is N, which matches any base */
+    int32_t  max_mismatch;        /* most mismatches a read's linker can have */
+    int32_t  max_shift;           /* furthest (in bases) to look for a linker that isn't where expected */
+    int32_t  keep;                /* copy rejected reads to the unmatched output (1) or drop them (0) */
+    uint64_t counts[SB_LINKER_N]; /* reads with each outcome */
+};
+
+// Set up a check for linker seq (A, C, G, T, or N, any case), allowing up to max_mismatch mismatches and looking up
+// to max_shift bases either side of where it is expected
+// Returns 0 on success, -1 if seq is not a valid linker (error printed)
+int sb_linker_init(sb_linker_t *lk, const char *seq, int32_t max_mismatch, int32_t max_shift, int keep);
+
+// Check the linker right after the UMI (bd->umi_len) of every read in the batch with a barcode (r->bc >= 0 when
+// demultiplexing), setting r->shift to how far it was found from where expected, or r->bc to SB_BC_NONE (keep) or
+// SB_BC_DROP (drop) for reads without one. Adds the outcomes to lk->counts
+void sb_linker_check(sb_linker_t *lk, const sb_builder_t *bd, sb_batch_t *b);
+
+#endif /* LINKER_H */
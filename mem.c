@@ -0,0 +1,85 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2022-2023 Jacob Morrison <jacob.morrison@vai.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "mem.h"
+
+// Map size bytes of page-aligned memory. With huge, the pages come from the kernel's reserved huge page pool if it has
+// any (MAP_HUGETLB), otherwise the mapping is aligned to a huge page and marked for transparent huge pages
+// Returns NULL if the memory could not be mapped
+static char *map(size_t size, int huge) {
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    if (!huge) {
+        void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+        return p == MAP_FAILED ? NULL : (char *)p;
+    }
+
+#ifdef MAP_HUGETLB
+    void *h = mmap(NULL, size, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB, -1, 0);
+    if (h != MAP_FAILED) { return (char *)h; }
+#endif
+
+    // Map a huge page more than needed and trim either end, as transparent huge pages only back aligned ranges
+    void *p = mmap(NULL, size + SB_HUGE_PAGE, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (p == MAP_FAILED) { return NULL; }
+
+    char   *s    = (char *)p;
+    size_t  head = (SB_HUGE_PAGE - (size_t)s % SB_HUGE_PAGE) % SB_HUGE_PAGE;
+    if (head > 0) { munmap(s, head); }
+    munmap(s + head + size, SB_HUGE_PAGE - head);
+    s += head;
+
+#ifdef MADV_HUGEPAGE
+    madvise(s, size, MADV_HUGEPAGE);
+#endif
+
+    return s;
+}
+
+int sb_mem_resize(kstring_t *s, size_t size, int huge) {
+    if (size <= s->m) { return 0; }
+
+    // Grow to the next power of two, in whole (huge) pages
+    size_t page = huge ? SB_HUGE_PAGE : (size_t)sysconf(_SC_PAGESIZE);
+    kroundup32(size);
+    size = (size + page - 1) / page * page;
+
+    char *p = map(size, huge);
+    if (!p) { return -1; }
+    if (s->l > 0) { memcpy(p, s->s, s->l); }
+    if (s->s) { munmap(s->s, s->m); }
+    s->s = p;
+    s->m = size;
+
+    return 0;
+}
+
+void sb_mem_free(kstring_t *s) {
+    if (s->s) { munmap(s->s, s->m); }
+    s->s = NULL;
+    s->l = 0;
+    s->m = 0;
+}
@@ -0,0 +1,363 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2022-2023 Jacob Morrison <jacob.morrison@vai.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "parse.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define SB_PARSE_X86 1
+#include <immintrin.h>
+#endif
+
+typedef const char *(*find_fn)(const char *p, const char *end);
+typedef int (*any_fn)(const char *p, size_t n);
+
+// Same characters as isspace() in the C locale, which kseq uses to end the read name
+static inline int is_space(int c) {
+    return c == ' ' || (unsigned)(c - '\t') <= '\r' - '\t';
+}
+
+// Length of a line ending at end, without a trailing '\r' (kept when it is the only character, as kseq does)
+static inline size_t line_len(const char *s, const char *end) {
+    size_t l = end - s;
+    return (l > 1 && end[-1] == '\r') ? l - 1 : l;
+}
+
+// Scanners return the first newline (or whitespace) in [p, end), or end if there is none. Vector loads never read
+// past end, so the last few bytes are checked one at a time
+static inline __attribute__((always_inline)) const char *find_nl_scalar(const char *p, const char *end) {
+    const char *e = (const char *)memchr(p, '\n', end - p);
+    return e ? e : end;
+}
+
+static inline __attribute__((always_inline)) const char *find_space_scalar(const char *p, const char *end) {
+    while (p < end && !is_space((unsigned char)*p)) { p++; }
+    return p;
+}
+
+// Returns 1 if there is a newline in the n bytes at p. Unlike the scanners there is no early exit, the vector versions
+// OR the matches of every block (the last one overlapping) and test once
+static inline __attribute__((always_inline)) int any_nl_scalar(const char *p, size_t n) {
+    return memchr(p, '\n', n) != NULL;
+}
+
+#ifdef SB_PARSE_X86
+static inline __attribute__((always_inline)) const char *find_nl_sse2(const char *p, const char *end) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    for (; p + 16 <= end; p += 16) {
+        int m = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p), nl));
+        if (m) { return p + __builtin_ctz(m); }
+    }
+    while (p < end && *p != '\n') { p++; }
+    return p;
+}
+
+// A byte is whitespace if it is ' ' or falls in '\t'..'\r', the range check is an unsigned min after subtracting '\t'
+static inline __attribute__((always_inline)) const char *find_space_sse2(const char *p, const char *end) {
+    const __m128i sp  = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i rng = _mm_set1_epi8('\r' - '\t');
+    for (; p + 16 <= end; p += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        __m128i t = _mm_sub_epi8(v, tab);
+        __m128i w = _mm_or_si128(_mm_cmpeq_epi8(v, sp), _mm_cmpeq_epi8(_mm_min_epu8(t, rng), t));
+        int m = _mm_movemask_epi8(w);
+        if (m) { return p + __builtin_ctz(m); }
+    }
+    return find_space_scalar(p, end);
+}
+
+static inline __attribute__((always_inline)) int any_nl_sse2(const char *p, size_t n) {
+    if (n < 16) { return any_nl_scalar(p, n); }
+
+    const __m128i nl = _mm_set1_epi8('\n');
+    __m128i       m  = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + n - 16)), nl);
+    size_t        i;
+    for (i = 0; i + 16 < n; i += 16) {
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + i)), nl));
+    }
+    return _mm_movemask_epi8(m) != 0;
+}
+
+__attribute__((target("avx2")))
+static inline __attribute__((always_inline)) const char *find_nl_avx2(const char *p, const char *end) {
+    const __m256i nl = _mm256_set1_epi8('\n');
+    for (; p + 32 <= end; p += 32) {
+        uint32_t m = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)p), nl));
+        if (m) { return p + __builtin_ctz(m); }
+    }
+    return find_nl_sse2(p, end);
+}
+
+__attribute__((target("avx2")))
+static inline __attribute__((always_inline)) const char *find_space_avx2(const char *p, const char *end) {
+    const __m256i sp  = _mm256_set1_epi8(' ');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i rng = _mm256_set1_epi8('\r' - '\t');
+    for (; p + 32 <= end; p += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        __m256i t = _mm256_sub_epi8(v, tab);
+        __m256i w = _mm256_or_si256(_mm256_cmpeq_epi8(v, sp), _mm256_cmpeq_epi8(_mm256_min_epu8(t, rng), t));
+        uint32_t m = _mm256_movemask_epi8(w);
+        if (m) { return p + __builtin_ctz(m); }
+    }
+    return find_space_sse2(p, end);
+}
+
+__attribute__((target("avx2")))
+static inline __attribute__((always_inline)) int any_nl_avx2(const char *p, size_t n) {
+    if (n < 32) { return any_nl_sse2(p, n); }
+
+    const __m256i nl = _mm256_set1_epi8('\n');
+    __m256i       m  = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + n - 32)), nl);
+    size_t        i;
+    for (i = 0; i + 32 < n; i += 32) {
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + i)), nl));
+    }
+    return _mm256_movemask_epi8(m) != 0;
+}
+#endif
+
+// Returns 1 if a record with a sequence of length l starting at s has the layout of a fixed-length run: sequence,
+// a bare "+" line, and a quality of the same length, with no '\r' line endings and the newlines where the length
+// puts them. The sequence and quality are tested for stray newlines as wholes rather than scanned for the first one
+static inline __attribute__((always_inline)) int fixed_lines(const char *s, const char *end, size_t l, any_fn any_nl) {
+    const char *q = s + l + 3;
+    return q + l < end && s[l] == '\n' && s[l + 1] == '+' && s[l + 2] == '\n' && q[l] == '\n' && s[l - 1] != '\r' &&
+           q[l - 1] != '\r' && !any_nl(s, l) && !any_nl(q, l);
+}
+
+// Shared body of the view parsers, find_nl, find_space, and any_nl are constants in each caller so the scanners are
+// inlined. Runs of reads of one length, the usual case for a sequencing run, skip the line scans: each read is first
+// checked against the length of the one before it with fixed_lines() and only scanned when that fails
+static inline __attribute__((always_inline)) int32_t parse_views(const char **pp, const char *end, sb_rec_t *recs,
+        int32_t n, find_fn find_nl, find_fn find_space, any_fn any_nl) {
+    const char *p     = *pp;
+    size_t      fix_l = 0;
+
+    int32_t i;
+    for (i = 0; i < n; i++) {
+        // Header, sequence, separator, and quality lines must all end inside the buffer
+        if (p >= end || *p != '@') { break; }
+        const char *e1 = find_nl(p + 1, end);
+        if (e1 == end) { break; }
+
+        // An empty sequence line, or one that starts a new record, is left to sb_parse_record()
+        const char *s = e1 + 1;
+        if (s >= end || *s == '\n' || *s == '@' || *s == '+' || *s == '>') { break; }
+
+        const char *q, *e4;
+        size_t      seq_l, qual_l;
+        if (fix_l && fixed_lines(s, end, fix_l, any_nl)) {
+            q     = s + fix_l + 3;
+            e4    = q + fix_l;
+            seq_l = qual_l = fix_l;
+        } else {
+            const char *e2 = find_nl(s, end);
+            if (e2 == end) { break; }
+
+            const char *sep = e2 + 1;
+            if (sep >= end || *sep != '+') { break; }
+            const char *e3 = find_nl(sep, end);
+            if (e3 == end) { break; }
+
+            q  = e3 + 1;
+            e4 = find_nl(q, end);
+            if (e4 == end) { break; }
+
+            // A shorter quality continues on the next line and a longer one is an error, both handled by
+            // sb_parse_record()
+            seq_l  = line_len(s, e2);
+            qual_l = line_len(q, e4);
+            if (seq_l != qual_l) { break; }
+            fix_l = seq_l;
+        }
+
+        // Name ends at the first whitespace, anything after it is the comment
+        const char *name = p + 1;
+        const char *ws   = find_space(name, e1);
+
+        sb_rec_t *r  = &recs[i];
+        r->name      = (char *)name;
+        r->name_l    = ws - name;
+        r->comment   = (char *)(ws < e1 ? ws + 1 : e1);
+        r->comment_l = ws < e1 ? line_len(ws + 1, e1) : 0;
+        r->seq       = (char *)s;
+        r->seq_l     = seq_l;
+        r->qual      = (char *)q;
+        r->qual_l    = qual_l;
+
+        p = e4 + 1;
+    }
+    *pp = p;
+
+    return i;
+}
+
+#ifdef SB_PARSE_X86
+static int32_t parse_views_sse2(const char **p, const char *end, sb_rec_t *recs, int32_t n) {
+    return parse_views(p, end, recs, n, find_nl_sse2, find_space_sse2, any_nl_sse2);
+}
+
+__attribute__((target("avx2")))
+static int32_t parse_views_avx2(const char **p, const char *end, sb_rec_t *recs, int32_t n) {
+    return parse_views(p, end, recs, n, find_nl_avx2, find_space_avx2, any_nl_avx2);
+}
+#endif
+
+int32_t sb_parse_views(const char **p, const char *end, sb_rec_t *recs, int32_t n) {
+#ifdef SB_PARSE_X86
+    if (__builtin_cpu_supports("avx2")) { return parse_views_avx2(p, end, recs, n); }
+    return parse_views_sse2(p, end, recs, n);
+#else
+    return parse_views(p, end, recs, n, find_nl_scalar, find_space_scalar, any_nl_scalar);
+#endif
+}
+
+// Position in the buffer being parsed by sb_parse_record()
+typedef struct {
+    const char *p;    /* next byte to read */
+    const char *end;  /* end of the buffer */
+    int         eof;  /* end is the end of the input */
+    int         more; /* ran out of bytes before the end of the input */
+} cursor_t;
+
+// Mirrors ks_getc()
+static inline int cur_getc(cursor_t *c) {
+    if (c->p < c->end) { return (unsigned char)*c->p++; }
+    if (!c->eof) { c->more = 1; }
+
+    return -1;
+}
+
+// Mirrors ks_getuntil2() with KS_SEP_LINE (line = 1) or KS_SEP_SPACE (line = 0)
+// Returns the length of str, -1 if no bytes were left, -3 if memory could not be allocated
+static int cur_getuntil(cursor_t *c, int line, kstring_t *str, int *dret, int append) {
+    if (dret) { *dret = 0; }
+    if (!append) { str->l = 0; }
+    if (c->p >= c->end) {
+        if (!c->eof) { c->more = 1; }
+        return -1;
+    }
+
+    const char *e = line ? find_nl_scalar(c->p, c->end) : find_space_scalar(c->p, c->end);
+    if (ks_resize(str, str->l + (e - c->p) + 1) < 0) { return -3; }
+    memcpy(str->s + str->l, c->p, e - c->p);
+    str->l += e - c->p;
+
+    if (e < c->end) {
+        if (dret) { *dret = (unsigned char)*e; }
+        c->p = e + 1;
+    } else {
+        c->p = e;
+        if (!c->eof) { c->more = 1; }
+    }
+    if (line && str->l > 1 && str->s[str->l-1] == '\r') { str->l--; }
+    str->s[str->l] = '\0';
+
+    return (int)str->l;
+}
+
+void sb_parser_destroy(sb_parser_t *ps) {
+    free(ps->name.s);
+    free(ps->comment.s);
+    free(ps->seq.s);
+    free(ps->qual.s);
+    memset(ps, 0, sizeof(sb_parser_t));
+}
+
+// Follows kseq_read() step by step, a record cut off by the end of the buffer is restarted from the beginning once
+// more bytes are available
+int sb_parse_record(sb_parser_t *ps, const char **p, const char *end, int eof, sb_rec_t *r) {
+    cursor_t c = { *p, end, eof, 0 };
+    int      ch, ret;
+
+    // Jump to the next header line
+    while ((ch = cur_getc(&c)) >= 0 && ch != '>' && ch != '@');
+    if (ch < 0) { return c.more ? SB_PARSE_MORE : SB_PARSE_EOF; }
+
+    ps->comment.l = ps->seq.l = ps->qual.l = 0;
+    if ((ret = cur_getuntil(&c, 0, &ps->name, &ch, 0)) < 0) {
+        if (ret == -3) { return SB_PARSE_MEM; }
+        return c.more ? SB_PARSE_MORE : SB_PARSE_EOF;
+    }
+    if (ch != '\n' && cur_getuntil(&c, 1, &ps->comment, NULL, 0) == -3) { return SB_PARSE_MEM; }
+    if (c.more) { return SB_PARSE_MORE; }
+
+    // Sequence lines, skipping empty lines, until the separator or the next header
+    while ((ch = cur_getc(&c)) >= 0 && ch != '>' && ch != '+' && ch != '@') {
+        if (ch == '\n') { continue; }
+        if (ks_resize(&ps->seq, ps->seq.l + 2) < 0) { return SB_PARSE_MEM; }
+        ps->seq.s[ps->seq.l++] = ch;
+        if (cur_getuntil(&c, 1, &ps->seq, NULL, 1) == -3) { return SB_PARSE_MEM; }
+    }
+    if (c.more) { return SB_PARSE_MORE; }
+    if (ks_resize(&ps->seq, ps->seq.l + 1) < 0) { return SB_PARSE_MEM; }
+    ps->seq.s[ps->seq.l] = '\0';
+
+    if (ch == '+') {
+        // Skip the rest of the separator, then read quality lines until they cover the sequence
+        while ((ch = cur_getc(&c)) >= 0 && ch != '\n');
+        if (c.more) { return SB_PARSE_MORE; }
+        if (ch < 0) { return SB_PARSE_TRUNC; }
+
+        while ((ret = cur_getuntil(&c, 1, &ps->qual, NULL, 1)) >= 0 && ps->qual.l < ps->seq.l);
+        if (ret == -3) { return SB_PARSE_MEM; }
+        if (c.more) { return SB_PARSE_MORE; }
+        if (ps->seq.l != ps->qual.l) { return SB_PARSE_TRUNC; }
+    } else if (ch >= 0) {
+        // FASTA record, the header character that ended it starts the next record
+        c.p--;
+    }
+
+    r->name      = ps->name.s;
+    r->name_l    = ps->name.l;
+    r->comment   = ps->comment.s ? ps->comment.s : ps->name.s + ps->name.l;
+    r->comment_l = ps->comment.l;
+    r->seq       = ps->seq.s;
+    r->seq_l     = ps->seq.l;
+    r->qual      = ps->qual.s ? ps->qual.s : ps->seq.s + ps->seq.l;
+    r->qual_l    = ps->qual.l;
+    *p = c.p;
+
+    return SB_PARSE_OK;
+}
+
+int sb_parse_batch(sb_parser_t *ps, sb_batch_t *b, int32_t max_recs, const char **p, const char *end, int eof) {
+    while (b->n < max_recs) {
+        b->n += sb_parse_views(p, end, b->recs + b->n, max_recs - b->n);
+        if (b->n == max_recs) { break; }
+
+        sb_rec_t rec;
+        int ret = sb_parse_record(ps, p, end, eof, &rec);
+        if (ret != SB_PARSE_OK) { return ret; }
+        if (sb_batch_push(b, rec.name, rec.name_l, rec.comment, rec.comment_l, rec.seq, rec.seq_l, rec.qual,
+                    rec.qual_l) < 0) {
+            return SB_PARSE_MEM;
+        }
+    }
+
+    return SB_PARSE_OK;
+}
@@ -0,0 +1,64 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2022-2023 Jacob Morrison <jacob.morrison@vai.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef PARSE_H
+#define PARSE_H
+
+#include <stdint.h>
+
+#include "batch.h"
+#include "kstring.h"
+
+// Return values of sb_parse_record(), negative values match kseq_read()
+#define SB_PARSE_OK     0 /* record parsed into the parser's own storage */
+#define SB_PARSE_MORE   1 /* record continues past the end of the buffer */
+#define SB_PARSE_EOF   -1 /* no records left */
+#define SB_PARSE_TRUNC -2 /* truncated quality string or quality and sequence lengths differ */
+#define SB_PARSE_MEM   -3 /* unable to allocate space for the record */
+
+// Storage for records that can't be returned as views into the input
+typedef struct {
+    kstring_t name, comment, seq, qual;
+} sb_parser_t;
+
+void sb_parser_destroy(sb_parser_t *ps);
+
+// Parse consecutive plain records (one line each for header, sequence, "+", and quality) starting at *p, without
+// copying: each record points into [*p, end). Stops after n records or at the first record needing
+// sb_parse_record(), including a record that runs past end
+// Returns the number of records parsed, *p is moved past them
+int32_t sb_parse_views(const char **p, const char *end, sb_rec_t *recs, int32_t n);
+
+// Parse the next record starting at *p exactly as kseq_read() would, including multi-line sequences, empty lines,
+// and FASTA records (which have an empty quality). eof is 1 if end is the end of the input. On SB_PARSE_OK, r points
+// into ps until the next call and *p is moved past the record
+// Returns SB_PARSE_OK or one of the SB_PARSE_* codes above
+int sb_parse_record(sb_parser_t *ps, const char **p, const char *end, int eof, sb_rec_t *r);
+
+// Parse records from [*p, end) into the batch until it holds max_recs reads. Plain records point straight into the
+// buffer and only unusual records (split across lines, FASTA, ...) are copied into the batch storage, so
+// sb_batch_finalize() must be called before the records are used
+// Returns SB_PARSE_OK when the batch is full, otherwise the sb_parse_record() code that stopped parsing
+int sb_parse_batch(sb_parser_t *ps, sb_batch_t *b, int32_t max_recs, const char **p, const char *end, int eof);
+
+#endif /* PARSE_H */
@@ -0,0 +1,420 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2022-2023 Jacob Morrison <jacob.morrison@vai.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "pipeline.h"
+#include "queue.h"
+#include "batch.h"
+#include "record.h"
+#include "bgzf.h"
+#include "demux.h"
+#include "linker.h"
+#include "trim.h"
+#include "stats.h"
+#include "shard.h"
+#include "umistats.h"
+
+#define SB_BATCHES_PER_THREAD 4 /* batches in flight per worker thread */
+
+// Shared state between readers, workers, and writers
+typedef struct {
+    const sb_conf_t    *conf;
+    const sb_builder_t *bd;        /* read rewriting pieces */
+    sb_reader_t        *rd;        /* input */
+    sb_reader_t        *mate_rd;   /* mate input (paired input only) */
+    sb_writer_t        *mate_w;    /* mate output (paired input only) */
+    sb_shards_t        *mate_sh;   /* sharded mate output, replaces mate_w (paired input only) */
+    int32_t             n_batches; /* number of batches in flight */
+    sb_batch_t        **batches;   /* all allocated batches */
+    sb_queue_t          free_q;    /* batches ready to be filled by the reader */
+    sb_queue_t          mate_q;    /* batches waiting for the same reads from the mate reader */
+    sb_queue_t          work_q;    /* batches ready to be processed by a worker */
+    sb_reorder_t        done;      /* processed batches, handed to the writer in input order */
+    sb_queue_t          write_q;   /* written batches waiting for the mate writer */
+    int32_t             read_err;  /* reader hit an error */
+    int32_t             mate_err;  /* mate reader hit an error or the mates have different numbers of reads */
+    int32_t             write_err; /* mate writer hit an error */
+} sb_pipeline_t;
+
+// Stop every thread waiting on the pipeline
+static void close_queues(sb_pipeline_t *p) {
+    sb_queue_close(&p->free_q);
+    sb_queue_close(&p->mate_q);
+    sb_queue_close(&p->work_q);
+    sb_reorder_close(&p->done);
+    sb_queue_close(&p->write_q);
+}
+
+static void *reader_thread(void *data) {
+    sb_pipeline_t *p   = (sb_pipeline_t *)data;
+    uint64_t       idx = 0;
+    int32_t        err = 0;
+
+    sb_batch_t *b;
+    while ((b = (sb_batch_t *)sb_queue_pop(&p->free_q)) != NULL) {
+        sb_batch_reset(b);
+        b->idx = idx;
+
+        int n = sb_reader_fill(p->rd, b, SB_BATCH_RECS);
+        if (n < 0) {
+            err = 1;
+            break;
+        }
+
+        // With paired input an empty last batch still goes to the mate reader, which checks the mate has ended too. A
+        // batch ended by a bad record is the last, and goes on to have its reads written before the error is reported
+        if (n == 0 && !p->mate_rd && b->status == SB_OK) { break; }
+
+        idx++;
+        if (sb_queue_push(p->mate_rd ? &p->mate_q : &p->work_q, b) < 0 || n < SB_BATCH_RECS || b->status != SB_OK) {
+            break;
+        }
+    }
+
+    p->read_err = err;
+    if (p->mate_rd) {
+        sb_queue_close(&p->mate_q);
+    } else {
+        sb_reorder_finish(&p->done, idx);
+        sb_queue_close(&p->work_q);
+    }
+
+    return NULL;
+}
+
+// Fill each batch's mate with the same number of reads from the mate FASTQ
+static void *mate_reader_thread(void *data) {
+    sb_pipeline_t *p   = (sb_pipeline_t *)data;
+    uint64_t       idx = 0;
+    int32_t        err = 0;
+
+    sb_batch_t *b;
+    while ((b = (sb_batch_t *)sb_queue_pop(&p->mate_q)) != NULL) {
+        sb_batch_t *m = b->mate;
+        sb_batch_reset(m);
+
+        // Ask for one extra read after the last batch to find a mate FASTQ with reads left over, unless the batch was
+        // ended by a bad record and the reads after it were never read
+        int32_t stop = b->status != SB_OK;
+        int32_t last = !stop && b->n < SB_BATCH_RECS;
+        int     n    = sb_reader_fill(p->mate_rd, m, b->n + last);
+        if (n < 0) {
+            err = 1;
+            break;
+        }
+
+        // A bad mate record ends the batch at the reads before it
+        if (m->status != SB_OK && (b->status == SB_OK || m->err < b->err)) {
+            b->n      = m->n;
+            b->first  = m->first;
+            b->err    = m->err;
+            b->status = m->status;
+            stop      = 1;
+        } else if (n != b->n) {
+            fprintf(stderr, "Mate FASTQ has %s reads than FASTQ with UMIs\n", n < b->n ? "fewer" : "more");
+            err = 1;
+            break;
+        }
+
+        idx++;
+        if (sb_queue_push(&p->work_q, b) < 0 || last || stop) { break; }
+    }
+
+    p->mate_err = err;
+    sb_reorder_finish(&p->done, idx);
+    sb_queue_close(&p->work_q);
+
+    return NULL;
+}
+
+// Rewrite a batch and, for gzip output, compress it with the calling thread's compressor
+// Output split across shards is left for the shards to compress
+// With paired input, the mates of every read before the first error are passed through unchanged
+// UMIs are counted into the calling thread's statistics us (if not NULL)
+static void process_batch(const sb_conf_t *conf, const sb_builder_t *bd, sb_bgzf_t *z, sb_umi_stats_t *us,
+        sb_batch_t *b) {
+    sb_batch_t *m = b->mate;
+    uint64_t    t = sb_time_ns();
+
+    if (conf->demux) { sb_demux_assign(conf->demux, b); }
+    if (conf->linker) { sb_linker_check(conf->linker, bd, b); }
+    if (conf->trim) { sb_trim_apply(conf->trim, bd, conf->linker, b); }
+    if (us) { sb_umi_stats_add(us, bd, b); }
+
+    // Only rewrite reads before the first bad mate, unless a read before it fails first
+    int32_t n      = b->n;
+    int32_t status = SB_OK;
+    int32_t bad    = m ? sb_batch_check_mate(b, conf->check_names, &status) : -1;
+    if (bad >= 0) { b->n = bad; }
+
+    sb_batch_process(bd, b);
+
+    b->n = n;
+    if (bad >= 0 && (b->status == SB_OK || b->err > bad)) {
+        b->err    = bad;
+        b->status = status;
+    }
+    if (m && sb_batch_passthrough(m, b->status == SB_OK ? b->n : b->err, bd->filter ? b : NULL) < 0) {
+        b->err    = 0;
+        b->status = SB_ERR_MEM;
+    }
+
+    uint64_t t2 = sb_time_ns();
+    SB_STATS_ADD(conf->stats, format_ns, t2 - t);
+    if (!conf->compress) { return; }
+
+    int32_t split = sb_shards_split(conf);
+    if (!z || (!split && sb_bgzf_compress(z, &b->gz, b->out.s, b->out.l) < 0) ||
+            (m && !split && sb_bgzf_compress(z, &m->gz, m->out.s, m->out.l) < 0) ||
+            (b->miss.l && sb_bgzf_compress(z, &b->miss_gz, b->miss.s, b->miss.l) < 0)) {
+        b->err    = 0;
+        b->status = SB_ERR_COMPRESS;
+    }
+    SB_STATS_ADD(conf->stats, compress_ns, sb_time_ns() - t2);
+}
+
+static void *worker_thread(void *data) {
+    sb_pipeline_t  *p  = (sb_pipeline_t *)data;
+    sb_umi_stats_t *um = p->conf->umi_stats;
+    sb_bgzf_t      *z  = p->conf->compress ? sb_bgzf_init(p->conf->level) : NULL;
+    sb_umi_stats_t *us = um ? sb_umi_stats_init(um->umi_len) : NULL;
+
+    sb_batch_t *b;
+    while ((b = (sb_batch_t *)sb_queue_pop(&p->work_q)) != NULL) {
+        process_batch(p->conf, p->bd, z, us, b);
+        sb_reorder_put(&p->done, b->idx, b);
+    }
+    sb_bgzf_destroy(z);
+    if (um) { sb_umi_stats_merge(um, us); }
+    sb_umi_stats_destroy(us);
+
+    return NULL;
+}
+
+// Write the passed through mates of each batch, in the order the writer finished them
+static void *mate_writer_thread(void *data) {
+    sb_pipeline_t *p = (sb_pipeline_t *)data;
+
+    sb_batch_t *b;
+    while ((b = (sb_batch_t *)sb_queue_pop(&p->write_q)) != NULL) {
+        kstring_t *out = p->conf->compress && !sb_shards_split(p->conf) ? &b->mate->gz : &b->mate->out;
+        if (b->status != SB_ERR_COMPRESS && (p->mate_sh ? sb_shards_write(p->mate_sh, b->recs, out, p->bd->filter)
+                                                        : sb_writer_write(p->mate_w, out->s, out->l)) < 0) {
+            p->write_err = 1;
+            close_queues(p);
+            break;
+        }
+        sb_queue_push(&p->free_q, b);
+    }
+
+    return NULL;
+}
+
+// Write the processed reads of a batch into w (or its shards sh, if not NULL), and its unmatched reads into miss_w
+// when demultiplexing (or its rejected reads with a linker check), reporting any processing error
+// Returns 0 on success, 1 if the batch hit an error or could not be written
+static int write_batch(const sb_conf_t *conf, sb_batch_t *b, sb_writer_t *w, sb_shards_t *sh, sb_writer_t *miss_w,
+        uint64_t *n_reads) {
+    kstring_t *out  = conf->compress && !sb_shards_split(conf) ? &b->gz : &b->out;
+    kstring_t *miss = conf->compress ? &b->miss_gz : &b->miss;
+    int        skip = conf->demux || conf->linker || conf->trim;
+    if (b->status != SB_ERR_COMPRESS && ((sh ? sb_shards_write(sh, b->recs, out, skip)
+                                             : sb_writer_write(w, out->s, out->l)) < 0 ||
+                (miss_w && sb_writer_write(miss_w, miss->s, miss->l) < 0))) {
+        return 1;
+    }
+
+    if (b->status != SB_OK) {
+        // Count the failing read, as it was read before the failure was found, unless it could not be read at all
+        int32_t n = b->err + (b->status != SB_ERR_TRUNC && b->status != SB_ERR_READ);
+        *n_reads += n;
+        SB_STATS_ADD(conf->stats, n_reads, n);
+        char msg[SB_ERR_MSG];
+        fprintf(stderr, "%s\n", sb_batch_error(conf, b, msg, sizeof(msg)));
+        return 1;
+    }
+    *n_reads += b->n;
+    SB_STATS_ADD(conf->stats, n_reads, b->n);
+
+    return 0;
+}
+
+int sb_pipeline_run_serial(const sb_conf_t *conf, const sb_builder_t *bd, sb_reader_t *rd, sb_writer_t *w,
+        sb_writer_t *miss_w, pthread_mutex_t *w_lock, sb_batch_t *b, sb_bgzf_t *z, uint64_t *n_reads) {
+    sb_umi_stats_t *um  = conf->umi_stats;
+    sb_umi_stats_t *us  = um ? sb_umi_stats_init(um->umi_len) : NULL;
+    int             ret = 0;
+    for (;;) {
+        sb_batch_reset(b);
+
+        int n = sb_reader_fill(rd, b, SB_BATCH_RECS);
+        if (n < 0) {
+            ret = 1;
+            break;
+        }
+        if (n == 0 && b->status == SB_OK) { break; }
+
+        process_batch(conf, bd, z, us, b);
+
+        if (w_lock) { pthread_mutex_lock(w_lock); }
+        int err = write_batch(conf, b, w, NULL, miss_w, n_reads);
+        if (w_lock) { pthread_mutex_unlock(w_lock); }
+        if (err) {
+            ret = 1;
+            break;
+        }
+        if (n < SB_BATCH_RECS) { break; }
+    }
+    if (um) { sb_umi_stats_merge(um, us); }
+    sb_umi_stats_destroy(us);
+
+    return ret;
+}
+
+// Read, process, and write one batch at a time on the calling thread
+static int run_single(const sb_conf_t *conf, const sb_builder_t *bd, sb_reader_t *rd, sb_writer_t *w,
+        sb_writer_t *miss_w, uint64_t *n_reads) {
+    sb_batch_t *b = sb_batch_init(conf->huge_pages);
+    if (!b) {
+        fprintf(stderr, "Unable to allocate read batch\n");
+        return 1;
+    }
+
+    sb_bgzf_t *z = conf->compress ? sb_bgzf_init(conf->level) : NULL;
+
+    int ret = sb_pipeline_run_serial(conf, bd, rd, w, miss_w, NULL, b, z, n_reads);
+
+    sb_bgzf_destroy(z);
+    sb_batch_destroy(b);
+
+    return ret;
+}
+
+// Run reader and workers on their own threads while the calling thread writes batches in input order
+// With paired input, the mates are read and written by two more threads in lockstep with the reads with UMIs
+static int run_threaded(const sb_conf_t *conf, const sb_builder_t *bd, sb_reader_t *rd, sb_reader_t *mate_rd,
+        sb_writer_t *w, sb_writer_t *mate_w, sb_shards_t *sh, sb_shards_t *mate_sh, sb_writer_t *miss_w,
+        uint64_t *n_reads) {
+    sb_pipeline_t p = {0};
+    int32_t       i;
+    int           ret = 0;
+
+    p.conf      = conf;
+    p.bd        = bd;
+    p.rd        = rd;
+    p.mate_rd   = mate_rd;
+    p.mate_w    = mate_w;
+    p.mate_sh   = mate_sh;
+    p.n_batches = conf->n_threads * SB_BATCHES_PER_THREAD;
+
+    // A batch is only refilled after the writer is done with it, so the indices in flight never span more than
+    // n_batches and each has its own slot in done
+    p.batches = (sb_batch_t **)calloc(p.n_batches, sizeof(sb_batch_t *));
+    if (!p.batches || sb_queue_init(&p.free_q, p.n_batches) < 0 || sb_queue_init(&p.mate_q, p.n_batches) < 0 ||
+            sb_queue_init(&p.work_q, p.n_batches) < 0 || sb_reorder_init(&p.done, p.n_batches) < 0 ||
+            sb_queue_init(&p.write_q, p.n_batches) < 0) {
+        fprintf(stderr, "Unable to allocate read batches\n");
+        ret = 1;
+        goto cleanup;
+    }
+    for (i = 0; i < p.n_batches; i++) {
+        if ((p.batches[i] = sb_batch_init(conf->huge_pages)) == NULL ||
+                (mate_rd && (p.batches[i]->mate = sb_batch_init(conf->huge_pages)) == NULL)) {
+            fprintf(stderr, "Unable to allocate read batches\n");
+            ret = 1;
+            goto cleanup;
+        }
+        sb_queue_push(&p.free_q, p.batches[i]);
+    }
+
+    pthread_t  reader, mate_reader, mate_writer;
+    pthread_t *workers = (pthread_t *)calloc(conf->n_threads, sizeof(pthread_t));
+    if (!workers) {
+        fprintf(stderr, "Unable to allocate threads\n");
+        ret = 1;
+        goto cleanup;
+    }
+    pthread_create(&reader, NULL, reader_thread, &p);
+    if (mate_rd) {
+        pthread_create(&mate_reader, NULL, mate_reader_thread, &p);
+        pthread_create(&mate_writer, NULL, mate_writer_thread, &p);
+    }
+    for (i = 0; i < conf->n_threads; i++) { pthread_create(&workers[i], NULL, worker_thread, &p); }
+
+    sb_batch_t *b;
+    while ((b = (sb_batch_t *)sb_reorder_take(&p.done)) != NULL) {
+        if (write_batch(conf, b, w, sh, miss_w, n_reads)) {
+            // Still write the mates of the reads that were written
+            if (mate_rd) { sb_queue_push(&p.write_q, b); }
+            ret = 1;
+            break;
+        }
+        sb_queue_push(mate_rd ? &p.write_q : &p.free_q, b);
+    }
+
+    // Let the mate writer finish the batches handed to it, then stop the readers and workers early if a writer hit
+    // an error
+    sb_queue_close(&p.write_q);
+    if (mate_rd) { pthread_join(mate_writer, NULL); }
+    close_queues(&p);
+    pthread_join(reader, NULL);
+    if (mate_rd) { pthread_join(mate_reader, NULL); }
+    for (i = 0; i < conf->n_threads; i++) { pthread_join(workers[i], NULL); }
+    free(workers);
+    if (p.read_err || p.mate_err || p.write_err) { ret = 1; }
+
+cleanup:
+    if (p.batches) {
+        for (i = 0; i < p.n_batches; i++) { sb_batch_destroy(p.batches[i]); }
+    }
+    free(p.batches);
+    sb_queue_destroy(&p.free_q);
+    sb_queue_destroy(&p.mate_q);
+    sb_queue_destroy(&p.work_q);
+    sb_reorder_destroy(&p.done);
+    sb_queue_destroy(&p.write_q);
+
+    return ret;
+}
+
+int sb_pipeline_run(const sb_conf_t *conf, sb_reader_t *rd, sb_reader_t *mate_rd, sb_writer_t *w,
+        sb_writer_t *mate_w, sb_shards_t *sh, sb_shards_t *mate_sh, sb_writer_t *miss_w, uint64_t *n_reads) {
+    sb_builder_t bd;
+    if (sb_builder_init(&bd, conf) < 0) {
+        fprintf(stderr, "Unable to allocate read builder\n");
+        return 1;
+    }
+
+    *n_reads = 0;
+    int ret = (conf->n_threads > 1 || mate_rd || sh)
+                  ? run_threaded(conf, &bd, rd, mate_rd, w, mate_w, sh, mate_sh, miss_w, n_reads)
+                  : run_single(conf, &bd, rd, w, miss_w, n_reads);
+
+    sb_builder_destroy(&bd);
+
+    return ret;
+}
@@ -0,0 +1,56 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2022-2023 Jacob Morrison <jacob.morrison@vai.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "synthbar.h"
+#include "reader.h"
+#include "writer.h"
+#include "batch.h"
+#include "bgzf.h"
+#include "shard.h"
+
+// Rewrite every read from rd into w
+// With conf->n_threads > 1, a reader thread, n_threads worker threads, and a writer run concurrently, output order
+// always matches input order
+// For paired input, mate_rd holds the mates of the reads in rd, which are copied unchanged into mate_w by their own
+// reader and writer threads (mate_rd and mate_w are NULL for single-end input)
+// With sharded output (conf->n_shards or conf->reads_per_shard), reads go to sh (and mates to mate_sh) in place of w
+// (and mate_w), which are then NULL
+// When demultiplexing (conf->demux), reads whose index matched no barcode are copied unchanged into miss_w
+// Returns 0 on success, 1 on error; n_reads is set to the number of reads (or read pairs) processed
+int sb_pipeline_run(const sb_conf_t *conf, sb_reader_t *rd, sb_reader_t *mate_rd, sb_writer_t *w,
+        sb_writer_t *mate_w, sb_shards_t *sh, sb_shards_t *mate_sh, sb_writer_t *miss_w, uint64_t *n_reads);
+
+// Rewrite every read from rd into w on the calling thread, one batch at a time, using the caller's batch and
+// compressor (z is only used with conf->compress) so they can be reused from one input to the next. If w_lock is not
+// NULL, it is held while writing each batch, so several inputs can share w
+// Returns 0 on success, 1 on error; n_reads is increased by the number of reads processed
+int sb_pipeline_run_serial(const sb_conf_t *conf, const sb_builder_t *bd, sb_reader_t *rd, sb_writer_t *w,
+        sb_writer_t *miss_w, pthread_mutex_t *w_lock, sb_batch_t *b, sb_bgzf_t *z, uint64_t *n_reads);
+
+#endif /* PIPELINE_H */
@@ -0,0 +1,149 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2022-2023 Jacob Morrison <jacob.morrison@vai.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <stdlib.h>
+
+#include "queue.h"
+
+int sb_queue_init(sb_queue_t *q, int32_t size) {
+    q->items = (void **)calloc(size, sizeof(void *));
+    if (!q->items) { return -1; }
+    q->size   = size;
+    q->head   = 0;
+    q->n      = 0;
+    q->closed = 0;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->not_empty, NULL);
+    pthread_cond_init(&q->not_full, NULL);
+
+    return 0;
+}
+
+void sb_queue_destroy(sb_queue_t *q) {
+    if (!q->items) { return; }
+
+    free(q->items);
+    q->items = NULL;
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->not_empty);
+    pthread_cond_destroy(&q->not_full);
+}
+
+int sb_queue_push(sb_queue_t *q, void *item) {
+    pthread_mutex_lock(&q->lock);
+    while (q->n == q->size && !q->closed) { pthread_cond_wait(&q->not_full, &q->lock); }
+    if (q->closed) {
+        pthread_mutex_unlock(&q->lock);
+        return -1;
+    }
+    q->items[(q->head + q->n) % q->size] = item;
+    q->n++;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+
+    return 0;
+}
+
+void *sb_queue_pop(sb_queue_t *q) {
+    void *item = NULL;
+
+    pthread_mutex_lock(&q->lock);
+    while (q->n == 0 && !q->closed) { pthread_cond_wait(&q->not_empty, &q->lock); }
+    if (q->n > 0) {
+        item = q->items[q->head];
+        q->head = (q->head + 1) % q->size;
+        q->n--;
+        pthread_cond_signal(&q->not_full);
+    }
+    pthread_mutex_unlock(&q->lock);
+
+    return item;
+}
+
+void sb_queue_close(sb_queue_t *q) {
+    pthread_mutex_lock(&q->lock);
+    q->closed = 1;
+    pthread_cond_broadcast(&q->not_empty);
+    pthread_cond_broadcast(&q->not_full);
+    pthread_mutex_unlock(&q->lock);
+}
+
+int sb_reorder_init(sb_reorder_t *r, int32_t size) {
+    r->slots = (void **)calloc(size, sizeof(void *));
+    if (!r->slots) { return -1; }
+    r->size    = size;
+    r->closed  = 0;
+    r->next    = 0;
+    r->n_total = UINT64_MAX;
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->cond, NULL);
+
+    return 0;
+}
+
+void sb_reorder_destroy(sb_reorder_t *r) {
+    if (!r->slots) { return; }
+
+    free(r->slots);
+    r->slots = NULL;
+    pthread_mutex_destroy(&r->lock);
+    pthread_cond_destroy(&r->cond);
+}
+
+void sb_reorder_put(sb_reorder_t *r, uint64_t idx, void *item) {
+    pthread_mutex_lock(&r->lock);
+    r->slots[idx % r->size] = item;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+}
+
+void sb_reorder_finish(sb_reorder_t *r, uint64_t n_total) {
+    pthread_mutex_lock(&r->lock);
+    r->n_total = n_total;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+}
+
+void *sb_reorder_take(sb_reorder_t *r) {
+    void *item = NULL;
+
+    pthread_mutex_lock(&r->lock);
+    while (!r->closed && r->next < r->n_total && r->slots[r->next % r->size] == NULL) {
+        pthread_cond_wait(&r->cond, &r->lock);
+    }
+    if (!r->closed && r->next < r->n_total) {
+        item = r->slots[r->next % r->size];
+        r->slots[r->next % r->size] = NULL;
+        r->next++;
+    }
+    pthread_mutex_unlock(&r->lock);
+
+    return item;
+}
+
+void sb_reorder_close(sb_reorder_t *r) {
+    pthread_mutex_lock(&r->lock);
+    r->closed = 1;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+}
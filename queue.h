@@ -0,0 +1,86 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2022-2023 Jacob Morrison <jacob.morrison@vai.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+// Bounded blocking FIFO
+typedef struct {
+    void          **items;  /* ring buffer of queued items */
+    int32_t         size;   /* capacity of ring buffer */
+    int32_t         head;   /* index of first queued item */
+    int32_t         n;      /* number of queued items */
+    int32_t         closed; /* no more items will be pushed */
+    pthread_mutex_t lock;
+    pthread_cond_t  not_empty;
+    pthread_cond_t  not_full;
+} sb_queue_t;
+
+// Returns 0 on success, -1 if memory could not be allocated
+int sb_queue_init(sb_queue_t *q, int32_t size);
+void sb_queue_destroy(sb_queue_t *q);
+
+// Add item to the queue, waiting while the queue is full
+// Returns 0 on success, -1 if the queue has been closed
+int sb_queue_push(sb_queue_t *q, void *item);
+
+// Take the first item from the queue, waiting while the queue is empty
+// Returns NULL once the queue is closed and empty
+void *sb_queue_pop(sb_queue_t *q);
+
+// Wake all waiting threads, no more items can be pushed
+void sb_queue_close(sb_queue_t *q);
+
+// Hands out items finished out of order (e.g. by a pool of threads) in sequence
+// Items in flight must never span more than size sequence numbers, so each has its own slot
+typedef struct {
+    void          **slots;   /* finished items, slot is idx % size */
+    int32_t         size;    /* number of slots */
+    int32_t         closed;  /* stop handing out items */
+    uint64_t        next;    /* sequence number of next item to hand out */
+    uint64_t        n_total; /* number of items that will be put, UINT64_MAX until known */
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+} sb_reorder_t;
+
+// Returns 0 on success, -1 if memory could not be allocated
+int sb_reorder_init(sb_reorder_t *r, int32_t size);
+void sb_reorder_destroy(sb_reorder_t *r);
+
+// Add the item with sequence number idx
+void sb_reorder_put(sb_reorder_t *r, uint64_t idx, void *item);
+
+// Mark that only n_total items will be put
+void sb_reorder_finish(sb_reorder_t *r, uint64_t n_total);
+
+// Take the next item in sequence, waiting until it has been put
+// Returns NULL once all items have been taken or the reorder has been closed
+void *sb_reorder_take(sb_reorder_t *r);
+
+// Wake all waiting threads, nothing more will be handed out
+void sb_reorder_close(sb_reorder_t *r);
+
+#endif /* QUEUE_H */
@@ -0,0 +1,180 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2022-2023 Jacob Morrison <jacob.morrison@vai.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "reader.h"
+#include "instream.h"
+#include "parse.h"
+#include "mem.h"
+
+#define SB_READ_ERROR -4 /* streamed input could not be read or decompressed */
+
+struct sb_reader_s {
+    sb_instream_t *fh;     /* input file handle */
+    size_t         size;   /* bytes of streamed input read at once */
+    sb_parser_t    ps;     /* storage for records that can't be parsed in place */
+    const char    *p;      /* unparsed part of mapped input (NULL if streamed) */
+    const char    *end;    /* end of mapped input */
+    kstring_t      carry;  /* streamed bytes read past the end of the last batch */
+    int32_t        eof;    /* reached the end of streamed input */
+    uint64_t       n_read; /* number of reads read so far */
+    sb_stats_t    *st;     /* run counters (may be NULL) */
+    uint64_t       wait;   /* nanoseconds spent waiting on streamed input during the current fill */
+    uint64_t       bytes;  /* input bytes read during the current fill */
+};
+
+sb_reader_t *sb_reader_open(const char *fn, size_t bufsize, int32_t n_threads, int32_t backend, int32_t io,
+        sb_stats_t *st) {
+    sb_instream_t *fh = sb_instream_open(fn, n_threads, backend, io, st);
+    if (!fh) { return NULL; }
+
+    sb_reader_t *r = (sb_reader_t *)calloc(1, sizeof(sb_reader_t));
+    if (!r) {
+        sb_instream_close(fh);
+        return NULL;
+    }
+    r->fh   = fh;
+    r->size = bufsize > 0 ? bufsize : SB_READER_BUFSIZE;
+    r->st   = st;
+
+    size_t len;
+    if ((r->p = sb_instream_mapped(fh, &len)) != NULL) { r->end = r->p + len; }
+
+    return r;
+}
+
+void sb_reader_close(sb_reader_t *r) {
+    if (!r) { return; }
+
+    sb_parser_destroy(&r->ps);
+    free(r->carry.s);
+    sb_instream_close(r->fh);
+    free(r);
+}
+
+// Grow the batch's input buffer to hold at least size bytes, moving the records that point into it
+// Returns 0 on success, -1 if memory could not be allocated
+static int grow_raw(sb_batch_t *b, size_t size, const char **p) {
+    kstring_t grown = {0, 0, NULL};
+    if (sb_mem_resize(&grown, size, b->huge) < 0) { return -1; }
+    char *s = grown.s;
+    memcpy(s, b->raw.s, b->raw.l);
+
+    // Copied records (name not set yet) live in b->data and don't move
+    int32_t i;
+    for (i = 0; i < b->n; i++) {
+        sb_rec_t *rec = &b->recs[i];
+        if (!rec->name) { continue; }
+        rec->name    = s + (rec->name    - b->raw.s);
+        rec->comment = s + (rec->comment - b->raw.s);
+        rec->seq     = s + (rec->seq     - b->raw.s);
+        rec->qual    = s + (rec->qual    - b->raw.s);
+    }
+    *p = s + (*p - b->raw.s);
+
+    grown.l = b->raw.l;
+    sb_mem_free(&b->raw);
+    b->raw = grown;
+
+    return 0;
+}
+
+// Fill the batch from streamed input. Decompressed bytes are read into the batch's own buffer, so records can point
+// into it like they do for mapped input, and bytes past the last record are carried over to the next batch
+// Returns SB_PARSE_OK when the batch is full, SB_PARSE_EOF at the end of input, otherwise the error code
+static int fill_streamed(sb_reader_t *r, sb_batch_t *b, int32_t max_recs) {
+    kstring_t *raw = &b->raw;
+
+    raw->l = 0;
+    if (sb_mem_resize(raw, r->carry.l + r->size, b->huge) < 0) { return SB_PARSE_MEM; }
+    if (r->carry.l > 0) { memcpy(raw->s, r->carry.s, r->carry.l); }
+    raw->l = r->carry.l;
+
+    const char *p = raw->s;
+    int         ret;
+    while ((ret = sb_parse_batch(&r->ps, b, max_recs, &p, raw->s + raw->l, r->eof)) == SB_PARSE_MORE) {
+        if (raw->m - raw->l < r->size && grow_raw(b, raw->m << 1, &p) < 0) { return SB_PARSE_MEM; }
+
+        uint64_t t = sb_time_ns();
+        int      n = sb_instream_read(r->fh, raw->s + raw->l, (int)r->size);
+        r->wait += sb_time_ns() - t;
+        if (n < 0 || (n == 0 && sb_instream_error(r->fh))) { return SB_READ_ERROR; }
+        if (n == 0) { r->eof = 1; }
+        raw->l   += n;
+        r->bytes += n;
+    }
+
+    r->carry.l = 0;
+    if (ret == SB_PARSE_OK && kputsn_(p, raw->s + raw->l - p, &r->carry) < 0) { return SB_PARSE_MEM; }
+
+    return ret;
+}
+
+int sb_reader_fill(sb_reader_t *r, sb_batch_t *b, int32_t max_recs) {
+    uint64_t    t     = sb_time_ns();
+    const char *start = r->p;
+
+    r->wait  = 0;
+    r->bytes = 0;
+
+    int ret;
+    if (sb_batch_reserve(b, max_recs) < 0) {
+        ret = SB_PARSE_MEM;
+    } else if (r->p) {
+        ret = sb_parse_batch(&r->ps, b, max_recs, &r->p, r->end, 1);
+        r->bytes = r->p - start;
+    } else {
+        ret = fill_streamed(r, b, max_recs);
+    }
+    sb_batch_finalize(b);
+
+    SB_STATS_ADD(r->st, n_records, b->n);
+    SB_STATS_ADD(r->st, in_bytes, r->bytes);
+    SB_STATS_ADD(r->st, read_wait_ns, r->wait);
+    SB_STATS_ADD(r->st, parse_ns, sb_time_ns() - t - r->wait);
+
+    // A bad record ends the batch, the reads before it are kept and the error is reported once they are written
+    b->first = r->n_read;
+    switch (ret) {
+        case SB_PARSE_OK:
+        case SB_PARSE_EOF:
+            break;
+        case SB_PARSE_MEM:
+            fprintf(stderr, "Unable to reallocate sufficient space\n");
+            return -1;
+        case SB_PARSE_TRUNC:
+            b->err    = b->n;
+            b->status = SB_ERR_TRUNC;
+            break;
+        default:
+            b->err    = b->n;
+            b->status = SB_ERR_READ;
+            break;
+    }
+    r->n_read += b->n;
+
+    return b->n;
+}
@@ -0,0 +1,49 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2022-2023 Jacob Morrison <jacob.morrison@vai.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef READER_H
+#define READER_H
+
+#include "batch.h"
+#include "stats.h"
+
+#define SB_READER_BUFSIZE (1 << 16) /* default bytes of streamed input read at once (64 KB) */
+
+// FASTQ input, opaque to callers
+typedef struct sb_reader_s sb_reader_t;
+
+// Open a (possibly gzip compressed) FASTQ for reading, - for stdin, using n_threads threads and the inflate backend for
+// decompression, reading the file with io (SB_IO_*). Streamed (not mapped) input is read bufsize bytes at a time (0
+// for SB_READER_BUFSIZE). Records and bytes parsed, and time spent parsing and waiting on input, are added to st (if
+// not NULL)
+// Returns NULL if the file could not be opened
+sb_reader_t *sb_reader_open(const char *fn, size_t bufsize, int32_t n_threads, int32_t backend, int32_t io,
+        sb_stats_t *st);
+void sb_reader_close(sb_reader_t *r);
+
+// Fill batch with up to max_recs reads. A truncated or unreadable record ends the batch with its status set to
+// SB_ERR_TRUNC or SB_ERR_READ (err is the number of reads before it), and nothing more should be read
+// Returns the number of reads added to the batch (0 at end of input), -1 if memory could not be allocated
+int sb_reader_fill(sb_reader_t *r, sb_batch_t *b, int32_t max_recs);
+
+#endif /* READER_H */
@@ -0,0 +1,341 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2022-2023 Jacob Morrison <jacob.morrison@vai.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "record.h"
+#include "bam.h"
+#include "linker.h"
+#include "trim.h"
+
+#define SB_MIN(a, b) ((a) < (b) ? (a) : (b))
+
+// Append l bytes of s to p, returning the new end of p
+#define PUT(p, s, l) (memcpy((p), (s), (l)), (p) + (l))
+
+// Write a read's name and comment, returning the new end of p. The space is overwritten by the next piece when there
+// is no comment
+static inline char *put_name(char *p, const sb_rec_t *r) {
+    *p++ = '@';
+    p    = PUT(p, r->name, r->name_l);
+    *p   = ' ';
+    memcpy(p + 1, r->comment, r->comment_l);
+
+    return p + r->comment_l + (r->comment_l != 0);
+}
+
+// Shared body of the rewriting functions. umi_first, remove_linker, demux, and linker are compile time constants in
+// each caller, so each specialization is a straight run of copies with no format parsing or layout checks. With
+// linker, reads that failed the linker check are left out and the rest are cut where their linker was found
+static inline __attribute__((always_inline)) size_t build_reads(const sb_builder_t *bd, const sb_rec_t *recs,
+        int32_t n, char *out, const int umi_first, const int remove_linker, const int demux, const int linker) {
+    char *p = out;
+
+    int32_t i;
+    for (i = 0; i < n; i++) {
+        const sb_rec_t *r = &recs[i];
+
+        // Demultiplexed reads take the barcode of their index, unmatched reads are written elsewhere. Without
+        // demultiplexing or a linker check, only trimming drops reads, so it is checked at run time
+        const char *bc     = bd->barcode;
+        size_t      bc_len = bd->bc_len;
+        if ((demux || linker || bd->filter) && r->bc < 0) { continue; }
+        if (demux) {
+            bc     = bd->demux->bcs[r->bc];
+            bc_len = bd->demux->bc_lens[r->bc];
+        }
+
+        // Reads shorter than the UMI keep all of their bases when the linker is not removed
+        size_t umi  = remove_linker ? bd->umi_len : SB_MIN(bd->umi_len, r->seq_l);
+        size_t skip = remove_linker ? bd->link_start + (linker ? r->shift : 0) : umi;
+        size_t tail = r->seq_l - skip;
+
+        p = put_name(p, r);
+
+        if (!umi_first) {
+            // "\n" + barcode, UMI, linker (if kept) and sequence, "\n+\n" + barcode qual, quality
+            p = PUT(p, bd->seq_pre, bd->seq_pre_l);
+            if (demux) { p = PUT(p, bc, bc_len); }
+            if (remove_linker) {
+                p = PUT(p, r->seq, umi);
+                p = PUT(p, r->seq + skip, tail);
+            } else {
+                p = PUT(p, r->seq, r->seq_l);
+            }
+            p = PUT(p, bd->qual_pre, bd->qual_pre_l);
+            if (demux) { p = PUT(p, bd->bc_qual, bc_len); }
+            if (remove_linker) {
+                p = PUT(p, r->qual, umi);
+                p = PUT(p, r->qual + skip, tail);
+            } else {
+                p = PUT(p, r->qual, r->qual_l);
+            }
+        } else {
+            // "\n" + UMI, barcode, linker (if kept) and sequence, "\n+\n" + UMI qual, barcode qual, quality
+            p = PUT(p, bd->seq_pre, bd->seq_pre_l);
+            p = PUT(p, r->seq, umi);
+            p = PUT(p, bc, bc_len);
+            p = PUT(p, r->seq + skip, tail);
+            p = PUT(p, bd->qual_pre, bd->qual_pre_l);
+            p = PUT(p, r->qual, umi);
+            p = PUT(p, bd->bc_qual, bc_len);
+            p = PUT(p, r->qual + skip, tail);
+        }
+        *p++ = '\n';
+    }
+
+    return p - out;
+}
+
+static size_t build_bc_umi(const sb_builder_t *bd, const sb_rec_t *recs, int32_t n, char *out) {
+    return build_reads(bd, recs, n, out, 0, 0, 0, 0);
+}
+
+static size_t build_bc_umi_demux(const sb_builder_t *bd, const sb_rec_t *recs, int32_t n, char *out) {
+    return build_reads(bd, recs, n, out, 0, 0, 1, 0);
+}
+
+static size_t build_bc_umi_nolink(const sb_builder_t *bd, const sb_rec_t *recs, int32_t n, char *out) {
+    return build_reads(bd, recs, n, out, 0, 1, 0, 0);
+}
+
+static size_t build_bc_umi_nolink_demux(const sb_builder_t *bd, const sb_rec_t *recs, int32_t n, char *out) {
+    return build_reads(bd, recs, n, out, 0, 1, 1, 0);
+}
+
+static size_t build_umi_bc(const sb_builder_t *bd, const sb_rec_t *recs, int32_t n, char *out) {
+    return build_reads(bd, recs, n, out, 1, 0, 0, 0);
+}
+
+static size_t build_umi_bc_demux(const sb_builder_t *bd, const sb_rec_t *recs, int32_t n, char *out) {
+    return build_reads(bd, recs, n, out, 1, 0, 1, 0);
+}
+
+static size_t build_umi_bc_nolink(const sb_builder_t *bd, const sb_rec_t *recs, int32_t n, char *out) {
+    return build_reads(bd, recs, n, out, 1, 1, 0, 0);
+}
+
+static size_t build_umi_bc_nolink_demux(const sb_builder_t *bd, const sb_rec_t *recs, int32_t n, char *out) {
+    return build_reads(bd, recs, n, out, 1, 1, 1, 0);
+}
+
+static size_t build_bc_umi_linker(const sb_builder_t *bd, const sb_rec_t *recs, int32_t n, char *out) {
+    return build_reads(bd, recs, n, out, 0, 1, 0, 1);
+}
+
+static size_t build_bc_umi_linker_demux(const sb_builder_t *bd, const sb_rec_t *recs, int32_t n, char *out) {
+    return build_reads(bd, recs, n, out, 0, 1, 1, 1);
+}
+
+static size_t build_umi_bc_linker(const sb_builder_t *bd, const sb_rec_t *recs, int32_t n, char *out) {
+    return build_reads(bd, recs, n, out, 1, 1, 0, 1);
+}
+
+static size_t build_umi_bc_linker_demux(const sb_builder_t *bd, const sb_rec_t *recs, int32_t n, char *out) {
+    return build_reads(bd, recs, n, out, 1, 1, 1, 1);
+}
+
+// Shared body of the rewriting functions for read structures that are not a UMI, skipped bases, and template, in
+// that order. The pieces were worked out when the structure was parsed, so each read is a run of copies with
+// offsets moved along by the bases it has beyond the fixed-length segments
+static inline __attribute__((always_inline)) size_t build_pieces(const sb_builder_t *bd, const sb_rec_t *recs,
+        int32_t n, char *out, const int umi_first, const int demux) {
+    const sb_structure_t *st = bd->st;
+    char *p = out;
+
+    int32_t i;
+    for (i = 0; i < n; i++) {
+        const sb_rec_t *r = &recs[i];
+
+        const char *bc     = bd->barcode;
+        size_t      bc_len = bd->bc_len;
+        if ((demux || bd->filter) && r->bc < 0) { continue; }
+        if (demux) {
+            bc     = bd->demux->bcs[r->bc];
+            bc_len = bd->demux->bc_lens[r->bc];
+        }
+        size_t extra = r->seq_l - st->min_len;
+
+        // "\n" + barcode, UMI, template (or UMI, barcode, template), "\n+\n" + the same for the quality
+        p = put_name(p, r);
+        p = PUT(p, bd->seq_pre, bd->seq_pre_l);
+        if (demux && !umi_first) { p = PUT(p, bc, bc_len); }
+        p = sb_put_pieces(p, st->umi, st->n_umi, r->seq, extra);
+        if (umi_first) { p = PUT(p, bc, bc_len); }
+        p = sb_put_pieces(p, st->tmpl, st->n_tmpl, r->seq, extra);
+        p = PUT(p, bd->qual_pre, bd->qual_pre_l);
+        if (demux && !umi_first) { p = PUT(p, bd->bc_qual, bc_len); }
+        p = sb_put_pieces(p, st->umi, st->n_umi, r->qual, extra);
+        if (umi_first) { p = PUT(p, bd->bc_qual, bc_len); }
+        p = sb_put_pieces(p, st->tmpl, st->n_tmpl, r->qual, extra);
+        *p++ = '\n';
+    }
+
+    return p - out;
+}
+
+static size_t build_pieces_bc_umi(const sb_builder_t *bd, const sb_rec_t *recs, int32_t n, char *out) {
+    return build_pieces(bd, recs, n, out, 0, 0);
+}
+
+static size_t build_pieces_bc_umi_demux(const sb_builder_t *bd, const sb_rec_t *recs, int32_t n, char *out) {
+    return build_pieces(bd, recs, n, out, 0, 1);
+}
+
+static size_t build_pieces_umi_bc(const sb_builder_t *bd, const sb_rec_t *recs, int32_t n, char *out) {
+    return build_pieces(bd, recs, n, out, 1, 0);
+}
+
+static size_t build_pieces_umi_bc_demux(const sb_builder_t *bd, const sb_rec_t *recs, int32_t n, char *out) {
+    return build_pieces(bd, recs, n, out, 1, 1);
+}
+
+// Write a read unchanged, returning the new end of p
+static inline char *put_plain(char *p, const sb_rec_t *r) {
+    p    = put_name(p, r);
+    *p++ = '\n';
+    p    = PUT(p, r->seq, r->seq_l);
+    p    = PUT(p, "\n+\n", 3);
+    p    = PUT(p, r->qual, r->qual_l);
+    *p++ = '\n';
+
+    return p;
+}
+
+size_t sb_build_plain(const sb_rec_t *recs, int32_t n, char *out) {
+    char *p = out;
+
+    int32_t i;
+    for (i = 0; i < n; i++) { p = put_plain(p, &recs[i]); }
+
+    return p - out;
+}
+
+size_t sb_build_unmatched(const sb_rec_t *recs, int32_t n, char *out) {
+    char *p = out;
+
+    int32_t i;
+    for (i = 0; i < n; i++) {
+        if (recs[i].bc == SB_BC_NONE) { p = put_plain(p, &recs[i]); }
+    }
+
+    return p - out;
+}
+
+int sb_builder_init(sb_builder_t *bd, const sb_conf_t *conf) {
+    memset(bd, 0, sizeof(sb_builder_t));
+
+    // The linker check needs the linker removed right after the UMI, so a read structure has to be UMI, linker (S),
+    // and template
+    const sb_structure_t *st       = conf->structure;
+    const sb_linker_t    *lk       = conf->linker;
+    size_t                link_len = st ? st->link_start - st->umi_len : (size_t)conf->linker_length;
+    if (lk && ((st && !st->simple) || (!st && !conf->remove_linker && !conf->bam) || link_len != lk->len)) {
+        return -1;
+    }
+    if (conf->trim && !sb_trim_fits(conf)) { return -1; }
+
+    // When demultiplexing, each read's barcode is written separately, so only the quality needs room for the longest
+    const sb_demux_t *dm     = conf->demux;
+    size_t            bc_len = dm ? dm->max_bc_len : strlen(conf->barcode);
+    int               fixed  = !conf->umi_first && !dm;
+
+    // One allocation holds: barcode, barcode qual, seq prefix, qual prefix
+    char *buf = (char *)malloc(4*bc_len + 4);
+    if (!buf) { return -1; }
+
+    bd->barcode = buf;
+    bd->bc_qual = buf + bc_len;
+    if (!dm) { memcpy(bd->barcode, conf->barcode, bc_len); }
+    memset(bd->bc_qual, 'I', bc_len);
+
+    bd->seq_pre  = buf + 2*bc_len;
+    bd->seq_pre[0] = '\n';
+    if (fixed) {
+        memcpy(bd->seq_pre + 1, bd->barcode, bc_len);
+        bd->seq_pre_l = bc_len + 1;
+    } else {
+        bd->seq_pre_l = 1;
+    }
+
+    bd->qual_pre = bd->seq_pre + bd->seq_pre_l;
+    memcpy(bd->qual_pre, "\n+\n", 3);
+    if (fixed) {
+        memcpy(bd->qual_pre + 3, bd->bc_qual, bc_len);
+        bd->qual_pre_l = bc_len + 3;
+    } else {
+        bd->qual_pre_l = 3;
+    }
+
+    // A read structure made up of a UMI, skipped bases, and template, in that order, is rewritten the same way as -r
+    // with the UMI and linker lengths it works out to, any other structure by its pieces
+    int cut = st ? 1 : conf->remove_linker;
+
+    bd->demux      = dm;
+    bd->st         = st && !st->simple ? st : NULL;
+    bd->bc_len     = bc_len;
+    bd->umi_len    = st ? st->umi_len : (size_t)conf->umi_length;
+    bd->link_start = st ? st->link_start : (size_t)(cut ? conf->umi_length + conf->linker_length : conf->umi_length);
+    bd->min_len    = st ? st->min_len : cut ? bd->link_start : 0;
+    bd->max_name_l = SIZE_MAX;
+    bd->extra      = 2*bc_len + (size_t)N_EXTRA_CHARS;
+    bd->filter     = dm || lk || (conf->trim && conf->trim->min_len);
+
+    if (conf->bam) {
+        // BAM records always leave the UMI and linker out of the sequence
+        if (!st) { bd->link_start = bd->min_len = (size_t)(conf->umi_length + conf->linker_length); }
+        bd->max_name_l = SB_BAM_MAX_NAME;
+        bd->extra      = bc_len + 2*bd->umi_len + SB_BAM_EXTRA;
+        if (lk) {
+            bd->build = dm ? sb_build_bam_linker_demux : sb_build_bam_linker;
+        } else if (bd->st) {
+            bd->build = dm ? sb_build_bam_pieces_demux : sb_build_bam_pieces;
+        } else {
+            bd->build = dm ? sb_build_bam_demux : sb_build_bam;
+        }
+    } else if (lk && !conf->umi_first) {
+        bd->build = dm ? build_bc_umi_linker_demux : build_bc_umi_linker;
+    } else if (lk) {
+        bd->build = dm ? build_umi_bc_linker_demux : build_umi_bc_linker;
+    } else if (bd->st && !conf->umi_first) {
+        bd->build = dm ? build_pieces_bc_umi_demux : build_pieces_bc_umi;
+    } else if (bd->st) {
+        bd->build = dm ? build_pieces_umi_bc_demux : build_pieces_umi_bc;
+    } else if (dm && !conf->umi_first) {
+        bd->build = cut ? build_bc_umi_nolink_demux : build_bc_umi_demux;
+    } else if (dm) {
+        bd->build = cut ? build_umi_bc_nolink_demux : build_umi_bc_demux;
+    } else if (!conf->umi_first) {
+        bd->build = cut ? build_bc_umi_nolink : build_bc_umi;
+    } else {
+        bd->build = cut ? build_umi_bc_nolink : build_umi_bc;
+    }
+
+    return 0;
+}
+
+void sb_builder_destroy(sb_builder_t *bd) {
+    free(bd->barcode);
+    bd->barcode = NULL;
+}
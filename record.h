@@ -0,0 +1,88 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2022-2023 Jacob Morrison <jacob.morrison@vai.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "synthbar.h"
+#include "batch.h"
+#include "demux.h"
+#include "structure.h"
+
+#define N_EXTRA_CHARS 7 /* '@' + 1 space + 3 newlines + 1 separator + 1 trailing newline */
+
+// Rewrite n reads into out, which must already have room for sb_build_size() bytes per read
+// Returns the number of bytes written
+typedef size_t (*sb_build_fn)(const sb_builder_t *bd, const sb_rec_t *recs, int32_t n, char *out);
+
+// Precomputed pieces of each rewritten read
+struct sb_builder_s {
+    char                 *seq_pre;    /* text placed before the UMI in the sequence line */
+    char                 *qual_pre;   /* text placed before the UMI in the quality line */
+    char                 *barcode;    /* barcode (placed after the UMI with --umi-first) */
+    char                 *bc_qual;    /* quality string matching barcode */
+    const sb_demux_t     *demux;      /* barcodes to take from each read's index (demultiplexing only) */
+    const sb_structure_t *st;         /* UMI and template pieces (read structures without a fast path only) */
+    size_t                seq_pre_l;  /* length of seq_pre */
+    size_t                qual_pre_l; /* length of qual_pre */
+    size_t                bc_len;     /* length of barcode (longest barcode when demultiplexing) */
+    size_t                umi_len;    /* number of bases in UMI */
+    size_t                link_start; /* offset of first base written after the UMI */
+    size_t                min_len;    /* shortest read that can be rewritten */
+    size_t                max_name_l; /* longest read name that can be rewritten */
+    size_t                extra;      /* bytes added to each read on top of its fields (upper bound) */
+    int32_t               filter;     /* reads with bc < 0 are not rewritten (demultiplexing, linker, or trimming) */
+    sb_build_fn           build;      /* rewriting function specialized for conf */
+};
+
+// Precompute read pieces and pick the specialized rewriting function
+// Returns 0 on success, -1 if memory could not be allocated, conf->linker doesn't fit the read layout (it must be
+// removed with -r or --bam, right after the UMI, and as long as the linker length), or conf->trim doesn't (see
+// sb_trim_fits)
+int sb_builder_init(sb_builder_t *bd, const sb_conf_t *conf);
+void sb_builder_destroy(sb_builder_t *bd);
+
+// Upper bound on the number of bytes a rewritten read takes up
+static inline size_t sb_build_size(const sb_builder_t *bd, const sb_rec_t *r) {
+    return r->name_l + r->comment_l + r->seq_l + r->qual_l + bd->extra;
+}
+
+// Number of bytes a read takes up when written unchanged
+static inline size_t sb_plain_size(const sb_rec_t *r) {
+    return r->name_l + r->comment_l + r->seq_l + r->qual_l + (size_t)N_EXTRA_CHARS;
+}
+
+// Write n reads into out unchanged (used for the mate of the reads with UMIs), out must already have room for
+// sb_plain_size() bytes per read
+// Returns the number of bytes written
+size_t sb_build_plain(const sb_rec_t *recs, int32_t n, char *out);
+
+// Write the reads among the first n that matched no barcode or failed the linker check (r->bc == SB_BC_NONE) into out
+// unchanged
+// Returns the number of bytes written
+size_t sb_build_unmatched(const sb_rec_t *recs, int32_t n, char *out);
+
+#endif /* RECORD_H */
@@ -0,0 +1,350 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2022-2023 Jacob Morrison <jacob.morrison@vai.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "shard.h"
+#include "queue.h"
+#include "writer.h"
+#include "bgzf.h"
+#include "stats.h"
+#include "structure.h"
+
+#define SB_SHARD_JOBS     4         /* output buffers in flight per shard */
+#define SB_SHARD_JOB_SIZE (1 << 20) /* bytes gathered before handing a buffer to the shard thread */
+
+// A single output file and the thread writing it
+typedef struct {
+    sb_writer_t *w;       /* output file */
+    sb_bgzf_t   *z;       /* compressor (split gzip output only) */
+    kstring_t    jobs[SB_SHARD_JOBS];
+    kstring_t   *cur;     /* buffer being filled, NULL if none */
+    kstring_t    gz;      /* compressed copy of the buffer being written */
+    sb_queue_t   free_q;  /* empty buffers */
+    sb_queue_t   work_q;  /* filled buffers waiting to be written */
+    pthread_t    thread;  /* thread writing the shard */
+    int32_t      started; /* thread has been started */
+    int32_t      joined;  /* thread has finished and the shard is closed */
+    int32_t      err;     /* shard hit an error */
+    sb_stats_t  *st;      /* run counters (may be NULL) */
+} sb_shard_t;
+
+struct sb_shards_s {
+    const sb_conf_t *conf;
+    char            *fn;        /* output name the shard names are made from */
+    int32_t          split;     /* reads of one batch can go to different shards */
+    int32_t          n;         /* number of shards opened */
+    int32_t          m;         /* number of shards allocated */
+    sb_shard_t     **shards;    /* all opened shards */
+    uint64_t         n_batches; /* number of batches handed out */
+    uint64_t         n_reads;   /* number of reads handed out (split output only) */
+    int32_t          err;       /* a shard could not be opened or closed */
+};
+
+char *sb_shard_name(const char *fn, int32_t i) {
+    static const char *exts[] = {".fastq.gz", ".fq.gz", ".fastq", ".fq", ".gz"};
+
+    size_t l   = strlen(fn);
+    size_t cut = l;
+    size_t j;
+    for (j = 0; j < sizeof(exts) / sizeof(exts[0]); j++) {
+        size_t el = strlen(exts[j]);
+        if (l > el && strcmp(fn + l - el, exts[j]) == 0) {
+            cut = l - el;
+            break;
+        }
+    }
+
+    char *name = (char *)malloc(l + 16);
+    if (!name) { return NULL; }
+    snprintf(name, l + 16, "%.*s.%03d%s", (int)cut, fn, i, fn + cut);
+
+    return name;
+}
+
+// Write filled buffers, compressing them first if they hold split gzip output
+static void *shard_thread(void *data) {
+    sb_shard_t *sh = (sb_shard_t *)data;
+
+    kstring_t *job;
+    while ((job = (kstring_t *)sb_queue_pop(&sh->work_q)) != NULL) {
+        kstring_t *out = job;
+        if (sh->z) {
+            uint64_t t = sb_time_ns();
+            sh->gz.l = 0;
+            if (sb_bgzf_compress(sh->z, &sh->gz, job->s, job->l) < 0) {
+                fprintf(stderr, "Unable to compress output\n");
+                sh->err = 1;
+                break;
+            }
+            SB_STATS_ADD(sh->st, compress_ns, sb_time_ns() - t);
+            out = &sh->gz;
+        }
+        if (sb_writer_write(sh->w, out->s, out->l) < 0) {
+            sh->err = 1;
+            break;
+        }
+
+        job->l = 0;
+        sb_queue_push(&sh->free_q, job);
+    }
+
+    // Stop the thread handing out reads rather than letting it wait on a shard that is no longer written
+    if (sh->err) {
+        sb_queue_close(&sh->free_q);
+        sb_queue_close(&sh->work_q);
+    }
+
+    return NULL;
+}
+
+// Hand over the partly filled buffer and let the thread finish once everything queued is written
+static void shard_finish(sb_shard_t *sh) {
+    if (sh->cur && sh->cur->l) {
+        sb_queue_push(&sh->work_q, sh->cur);
+        sh->cur = NULL;
+    }
+    sb_queue_close(&sh->work_q);
+}
+
+// Wait for the shard's thread and close its output
+// Returns 0 on success, -1 if any write failed
+static int shard_close(sb_shard_t *sh) {
+    int ret = 0;
+    if (sh->joined) { return 0; }
+
+    shard_finish(sh);
+    if (sh->started) { pthread_join(sh->thread, NULL); }
+    sh->joined = 1;
+    if (sh->err) { ret = -1; }
+    if (sh->w && sb_writer_close(sh->w) < 0) { ret = -1; }
+    sh->w = NULL;
+
+    return ret;
+}
+
+static void shard_destroy(sb_shard_t *sh) {
+    int32_t i;
+
+    if (!sh) { return; }
+    sb_bgzf_destroy(sh->z);
+    for (i = 0; i < SB_SHARD_JOBS; i++) { free(sh->jobs[i].s); }
+    free(sh->gz.s);
+    sb_queue_destroy(&sh->free_q);
+    sb_queue_destroy(&sh->work_q);
+    free(sh);
+}
+
+// Open the next shard and start its thread
+// Returns the shard, NULL if it could not be opened
+static sb_shard_t *shard_open(sb_shards_t *s) {
+    const sb_conf_t *conf = s->conf;
+
+    if (s->n == s->m) {
+        int32_t      m      = s->m ? s->m * 2 : 16;
+        sb_shard_t **shards = (sb_shard_t **)realloc(s->shards, m * sizeof(sb_shard_t *));
+        if (!shards) {
+            fprintf(stderr, "Unable to allocate output shards\n");
+            return NULL;
+        }
+        s->shards = shards;
+        s->m      = m;
+    }
+
+    sb_shard_t *sh = (sb_shard_t *)calloc(1, sizeof(sb_shard_t));
+    if (!sh || sb_queue_init(&sh->free_q, SB_SHARD_JOBS) < 0 || sb_queue_init(&sh->work_q, SB_SHARD_JOBS) < 0 ||
+            (conf->compress && s->split && (sh->z = sb_bgzf_init(conf->level)) == NULL)) {
+        fprintf(stderr, "Unable to allocate output shards\n");
+        shard_destroy(sh);
+        return NULL;
+    }
+    sh->st = conf->stats;
+
+    char *name = sb_shard_name(s->fn, s->n);
+    if (!name || (sh->w = sb_writer_open(name, conf->out_bufsize, conf->compress, conf->io, conf->stats)) == NULL) {
+        fprintf(stderr, "Could not open output file: %s\n", name ? name : s->fn);
+        free(name);
+        shard_destroy(sh);
+        return NULL;
+    }
+    free(name);
+
+    int32_t i;
+    for (i = 0; i < SB_SHARD_JOBS; i++) { sb_queue_push(&sh->free_q, &sh->jobs[i]); }
+    pthread_create(&sh->thread, NULL, shard_thread, sh);
+    sh->started = 1;
+
+    s->shards[s->n++] = sh;
+
+    return sh;
+}
+
+sb_shards_t *sb_shards_open(const sb_conf_t *conf, const char *fn) {
+    sb_shards_t *s = (sb_shards_t *)calloc(1, sizeof(sb_shards_t));
+    if (!s || (s->fn = strdup(fn)) == NULL) {
+        fprintf(stderr, "Unable to allocate output shards\n");
+        free(s);
+        return NULL;
+    }
+    s->conf  = conf;
+    s->split = sb_shards_split(conf);
+
+    // With reads_per_shard, later shards are opened as they are needed
+    int32_t n = conf->reads_per_shard > 0 ? 1 : conf->n_shards;
+    while (s->n < n) {
+        if (!shard_open(s)) {
+            sb_shards_close(s);
+            return NULL;
+        }
+    }
+
+    return s;
+}
+
+int sb_shards_close(sb_shards_t *s) {
+    int     ret = 0;
+    int32_t i;
+
+    if (!s) { return 0; }
+    if (s->err) { ret = -1; }
+    for (i = 0; i < s->n; i++) {
+        if (shard_close(s->shards[i]) < 0) { ret = -1; }
+        shard_destroy(s->shards[i]);
+    }
+    free(s->shards);
+    free(s->fn);
+    free(s);
+
+    return ret;
+}
+
+// Find shard i, opening it if reads_per_shard has moved past the last opened shard
+// The shard before the new one is handed its last buffer and the one before that is closed, so at most two
+// shards are open at once
+// Returns NULL if the shard could not be opened
+static sb_shard_t *get_shard(sb_shards_t *s, int32_t i) {
+    while (i >= s->n) {
+        if (s->n >= 1) { shard_finish(s->shards[s->n-1]); }
+        if (s->n >= 2 && shard_close(s->shards[s->n-2]) < 0) {
+            s->err = 1;
+            return NULL;
+        }
+        if (!shard_open(s)) {
+            s->err = 1;
+            return NULL;
+        }
+    }
+
+    return s->shards[i];
+}
+
+// Queue len bytes of output for shard i
+// Returns 0 on success, -1 on error
+static int shard_append(sb_shards_t *s, int32_t i, const char *data, size_t len) {
+    sb_shard_t *sh = get_shard(s, i);
+    if (!sh) { return -1; }
+
+    // Only fails once the shard's thread has stopped on an error, which it has already reported
+    if (!sh->cur && (sh->cur = (kstring_t *)sb_queue_pop(&sh->free_q)) == NULL) { return -1; }
+    if (kputsn(data, len, sh->cur) < 0) {
+        fprintf(stderr, "Unable to allocate output buffer\n");
+        return -1;
+    }
+    if (sh->cur->l >= SB_SHARD_JOB_SIZE) {
+        if (sb_queue_push(&sh->work_q, sh->cur) < 0) { return -1; }
+        sh->cur = NULL;
+    }
+
+    return 0;
+}
+
+// Skip past one four line FASTQ record
+static inline const char *next_record(const char *p, const char *end) {
+    int i;
+    for (i = 0; i < 4 && p < end; i++) {
+        const char *nl = (const char *)memchr(p, '\n', end - p);
+        p = nl ? nl + 1 : end;
+    }
+
+    return p;
+}
+
+// Add l bytes of s to FNV-1a hash h
+static inline uint64_t fnv1a(uint64_t h, const char *s, size_t l) {
+    size_t i;
+    for (i = 0; i < l; i++) { h = (h ^ (uint8_t)s[i]) * 0x100000001b3ULL; }
+
+    return h;
+}
+
+// Shard of a read with split output
+static inline int32_t read_shard(const sb_shards_t *s, const sb_rec_t *r) {
+    const sb_conf_t *conf = s->conf;
+    if (!conf->shard_umi) { return (int32_t)(s->n_reads / conf->reads_per_shard); }
+
+    // FNV-1a hash of the UMI, so reads with the same UMI always end up in the same shard
+    const sb_structure_t *st = conf->structure;
+    uint64_t h = 0xcbf29ce484222325ULL;
+    if (st) {
+        int32_t k;
+        for (k = 0; k < st->n_umi; k++) {
+            h = fnv1a(h, r->seq + st->umi[k].off + st->umi[k].shift*(r->seq_l - st->min_len), st->umi[k].len);
+        }
+    } else {
+        h = fnv1a(h, r->seq, r->seq_l < (size_t)conf->umi_length ? r->seq_l : (size_t)conf->umi_length);
+    }
+
+    return (int32_t)(h % (uint64_t)conf->n_shards);
+}
+
+int sb_shards_write(sb_shards_t *s, const sb_rec_t *recs, const kstring_t *out, int skip_unmatched) {
+    if (!s->split) {
+        int32_t i = (int32_t)(s->n_batches++ % (uint64_t)s->conf->n_shards);
+        return out->l ? shard_append(s, i, out->s, out->l) : 0;
+    }
+
+    // Hand over each run of consecutive reads going to the same shard at once
+    const char *p     = out->s;
+    const char *end   = out->s + out->l;
+    const char *start = p;
+    int32_t     cur   = -1;
+    for (; p < end; recs++) {
+        if (skip_unmatched && recs->bc < 0) { continue; }
+
+        int32_t i = read_shard(s, recs);
+        if (i != cur) {
+            if (cur >= 0 && shard_append(s, cur, start, p - start) < 0) { return -1; }
+            cur   = i;
+            start = p;
+        }
+        p = next_record(p, end);
+        s->n_reads++;
+    }
+    if (cur >= 0 && shard_append(s, cur, start, p - start) < 0) { return -1; }
+    s->n_batches++;
+
+    return 0;
+}
@@ -0,0 +1,61 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2022-2023 Jacob Morrison <jacob.morrison@vai.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <stdint.h>
+
+#include "synthbar.h"
+#include "batch.h"
+#include "kstring.h"
+
+typedef struct sb_shards_s sb_shards_t;
+
+// Whether reads of one batch can go to different shards, in which case each shard compresses its own output and
+// batches must be handed over uncompressed
+static inline int sb_shards_split(const sb_conf_t *conf) {
+    return conf->shard_umi || conf->reads_per_shard > 0;
+}
+
+// Name of shard i of fn, the shard number goes before a .fastq or .fq extension (and .gz) if there is one
+// Returns NULL if memory could not be allocated
+char *sb_shard_name(const char *fn, int32_t i);
+
+// Open the shards of output fn, each written (and with sb_shards_split, compressed) by its own thread
+// With conf->n_shards, batches are handed out round-robin or, with conf->shard_umi, reads are assigned by a hash of
+// their UMI. With conf->reads_per_shard, each shard gets that many reads and the next shard is opened when it is full
+// Returns NULL if a shard could not be opened
+sb_shards_t *sb_shards_open(const sb_conf_t *conf, const char *fn);
+
+// Flush remaining output, wait for the shard threads and close every shard
+// Returns 0 on success, -1 if any write failed
+int sb_shards_close(sb_shards_t *s);
+
+// Hand the reads in out, in order, to their shards. recs are the records out was built from (with skip_unmatched,
+// records without a barcode have no output and are left out), which are used to pick each read's shard
+// Batches must be handed over in input order
+// Returns 0 on success, -1 if a shard hit an error
+int sb_shards_write(sb_shards_t *s, const sb_rec_t *recs, const kstring_t *out, int skip_unmatched);
+
+#endif /* SHARD_H */
@@ -0,0 +1,297 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2022-2023 Jacob Morrison <jacob.morrison@vai.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "sheet.h"
+#include "pipeline.h"
+#include "reader.h"
+#include "writer.h"
+#include "record.h"
+#include "bgzf.h"
+#include "kstring.h"
+
+// Output file written by more than one sample
+typedef struct {
+    const char      *fn;   /* name of output file */
+    sb_writer_t     *w;    /* output */
+    pthread_mutex_t  lock; /* held while a sample writes a batch */
+} sb_shared_out_t;
+
+// State shared by the sample threads
+typedef struct {
+    const sb_conf_t  *conf;
+    const sb_sheet_t *sheet;
+    int32_t          *out;      /* index into shared for each sample, -1 if the sample has its own output */
+    int32_t           n_shared; /* number of shared outputs */
+    sb_shared_out_t  *shared;   /* outputs written by more than one sample */
+    pthread_mutex_t   lock;     /* guards next, err, and n_reads */
+    int32_t           next;     /* next sample to start */
+    int32_t           err;      /* a sample failed, no more are started */
+    uint64_t          n_reads;  /* reads processed over all samples */
+} sb_pool_t;
+
+// Split line into tab-separated fields, in place
+// Returns the number of fields found (at most max)
+static int split_tabs(char *line, char **fields, int max) {
+    int n = 0;
+    fields[n++] = line;
+    char *p;
+    for (p = line; *p; p++) {
+        if (*p != '\t') { continue; }
+        *p = '\0';
+        if (n == max) { return max + 1; }
+        fields[n++] = p + 1;
+    }
+
+    return n;
+}
+
+sb_sheet_t *sb_sheet_read(const char *fn, const char *default_outfn) {
+    FILE *fp = fopen(fn, "r");
+    if (!fp) {
+        fprintf(stderr, "Could not open sample sheet: %s\n", fn);
+        return NULL;
+    }
+
+    sb_sheet_t *s   = (sb_sheet_t *)calloc(1, sizeof(sb_sheet_t));
+    kstring_t   str = {0, 0, NULL};
+    char        buf[4096];
+    size_t      n;
+    while (s && (n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        if (kputsn(buf, n, &str) < 0) { break; }
+    }
+    int read_err = ferror(fp) || !feof(fp);
+    fclose(fp);
+    if (!s || read_err || kputc('\n', &str) < 0) {
+        fprintf(stderr, "Unable to read sample sheet: %s\n", fn);
+        free(str.s);
+        free(s);
+        return NULL;
+    }
+    s->text = str.s;
+
+    // Each line holds at most one sample, and only one sample can be read from stdin
+    int32_t m = 0, line = 0, stdin_line = 0;
+    char   *p = s->text, *eol;
+    for (; (eol = strchr(p, '\n')) != NULL; p = eol + 1) {
+        line++;
+        *eol = '\0';
+        if (eol > p && eol[-1] == '\r') { eol[-1] = '\0'; }
+        if (*p == '\0' || *p == '#') { continue; }
+
+        char *f[3];
+        int   n_fields = split_tabs(p, f, 3);
+        if (n_fields < 2 || n_fields > 3 || *f[0] == '\0' || *f[1] == '\0') {
+            fprintf(stderr, "Sample sheet line %i must be: input FASTQ, barcode, and optional output file\n", line);
+            sb_sheet_destroy(s);
+            return NULL;
+        }
+
+        if (strcmp(f[0], "-") == 0 && stdin_line) {
+            fprintf(stderr, "Sample sheet lines %i and %i both read from stdin (-)\n", stdin_line, line);
+            sb_sheet_destroy(s);
+            return NULL;
+        }
+        if (strcmp(f[0], "-") == 0) { stdin_line = line; }
+
+        if (s->n == m) {
+            m = m ? m << 1 : 64;
+            sb_sample_t *samples = (sb_sample_t *)realloc(s->samples, m * sizeof(sb_sample_t));
+            if (!samples) {
+                fprintf(stderr, "Unable to allocate sample sheet\n");
+                sb_sheet_destroy(s);
+                return NULL;
+            }
+            s->samples = samples;
+        }
+        sb_sample_t *sm = &s->samples[s->n++];
+        sm->infn    = f[0];
+        sm->barcode = f[1];
+        sm->outfn   = (n_fields == 3 && *f[2] != '\0') ? f[2] : (char *)default_outfn;
+        sm->line    = line;
+    }
+
+    if (s->n == 0) {
+        fprintf(stderr, "No samples found in sample sheet: %s\n", fn);
+        sb_sheet_destroy(s);
+        return NULL;
+    }
+
+    return s;
+}
+
+void sb_sheet_destroy(sb_sheet_t *s) {
+    if (!s) { return; }
+
+    free(s->samples);
+    free(s->text);
+    free(s);
+}
+
+// Rewrite one sample into its own output or a shared one
+// Returns 0 on success, 1 on error; n_reads is increased by the number of reads processed
+static int run_sample(sb_pool_t *pool, int32_t i, sb_batch_t *b, sb_bgzf_t *z, uint64_t *n_reads) {
+    const sb_sample_t *sm   = &pool->sheet->samples[i];
+    sb_conf_t          conf = *pool->conf;
+    sb_builder_t       bd;
+
+    conf.barcode = sm->barcode;
+    if (sb_builder_init(&bd, &conf) < 0) {
+        fprintf(stderr, "Unable to allocate read builder\n");
+        return 1;
+    }
+
+    int          ret = 1;
+    sb_writer_t *w   = NULL;
+    sb_reader_t *rd  = sb_reader_open(sm->infn, conf.in_bufsize, 1, conf.inflate, conf.io, conf.stats);
+    if (!rd) {
+        fprintf(stderr, "Could not open input file: %s\n", sm->infn);
+    } else if (pool->out[i] >= 0) {
+        sb_shared_out_t *o = &pool->shared[pool->out[i]];
+        ret = sb_pipeline_run_serial(&conf, &bd, rd, o->w, NULL, &o->lock, b, z, n_reads);
+    } else if ((w = sb_writer_open(sm->outfn, conf.out_bufsize, conf.compress, conf.io, conf.stats)) == NULL) {
+        fprintf(stderr, "Could not open output file: %s\n", sm->outfn);
+    } else if (conf.bam && sb_writer_bam_header(w, conf.level) < 0) {
+        sb_writer_close(w);
+    } else {
+        ret = sb_pipeline_run_serial(&conf, &bd, rd, w, NULL, NULL, b, z, n_reads);
+        if (sb_writer_close(w) < 0) { ret = 1; }
+    }
+
+    if (ret) { fprintf(stderr, "Failed to process sample on line %i of sample sheet (%s)\n", sm->line, sm->infn); }
+    sb_reader_close(rd);
+    sb_builder_destroy(&bd);
+
+    return ret;
+}
+
+static void *sample_thread(void *data) {
+    sb_pool_t *pool = (sb_pool_t *)data;
+
+    // Buffers are kept for the life of the thread
+    sb_batch_t *b = sb_batch_init(pool->conf->huge_pages);
+    sb_bgzf_t  *z = pool->conf->compress ? sb_bgzf_init(pool->conf->level) : NULL;
+    int         err = !b;
+    if (err) { fprintf(stderr, "Unable to allocate read batch\n"); }
+
+    for (;;) {
+        uint64_t n_reads = 0;
+        int32_t  i;
+
+        pthread_mutex_lock(&pool->lock);
+        if (err) { pool->err = 1; }
+        i = pool->err ? pool->sheet->n : pool->next++;
+        pthread_mutex_unlock(&pool->lock);
+        if (i >= pool->sheet->n) { break; }
+
+        err = run_sample(pool, i, b, z, &n_reads);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->n_reads += n_reads;
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    sb_bgzf_destroy(z);
+    sb_batch_destroy(b);
+
+    return NULL;
+}
+
+// Find the output files named by more than one sample, opening each once
+// Returns 0 on success, -1 if an output could not be allocated or opened
+static int open_shared(sb_pool_t *pool) {
+    const sb_sheet_t *s = pool->sheet;
+
+    pool->out    = (int32_t *)malloc(s->n * sizeof(int32_t));
+    pool->shared = (sb_shared_out_t *)calloc(s->n, sizeof(sb_shared_out_t));
+    if (!pool->out || !pool->shared) {
+        fprintf(stderr, "Unable to allocate sample outputs\n");
+        return -1;
+    }
+
+    int32_t i, j;
+    for (i = 0; i < s->n; i++) {
+        pool->out[i] = -1;
+        for (j = 0; j < i; j++) {
+            if (strcmp(s->samples[i].outfn, s->samples[j].outfn) == 0) { break; }
+        }
+        if (j < i) {
+            // Later sample using an earlier sample's output, share it
+            if (pool->out[j] < 0) {
+                sb_shared_out_t *o = &pool->shared[pool->n_shared];
+                o->fn = s->samples[j].outfn;
+                o->w  = sb_writer_open(o->fn, pool->conf->out_bufsize, pool->conf->compress, pool->conf->io, pool->conf->stats);
+                if (!o->w) {
+                    fprintf(stderr, "Could not open output file: %s\n", o->fn);
+                    return -1;
+                }
+
+                // Counted before the header is written, so the writer is closed along with the others if it fails
+                pthread_mutex_init(&o->lock, NULL);
+                pool->out[j] = pool->n_shared++;
+                if (pool->conf->bam && sb_writer_bam_header(o->w, pool->conf->level) < 0) { return -1; }
+            }
+            pool->out[i] = pool->out[j];
+        }
+    }
+
+    return 0;
+}
+
+int sb_sheet_run(const sb_conf_t *conf, const sb_sheet_t *s, uint64_t *n_reads) {
+    sb_pool_t pool = {0};
+    int32_t   i;
+    int       ret = 0;
+
+    pool.conf  = conf;
+    pool.sheet = s;
+    pthread_mutex_init(&pool.lock, NULL);
+
+    pthread_t *threads = NULL;
+    int32_t    n_threads = conf->n_threads < s->n ? conf->n_threads : s->n;
+    if (open_shared(&pool) < 0 || (threads = (pthread_t *)calloc(n_threads, sizeof(pthread_t))) == NULL) {
+        ret = 1;
+        goto cleanup;
+    }
+
+    for (i = 0; i < n_threads; i++) { pthread_create(&threads[i], NULL, sample_thread, &pool); }
+    for (i = 0; i < n_threads; i++) { pthread_join(threads[i], NULL); }
+    if (pool.err) { ret = 1; }
+
+cleanup:
+    for (i = 0; i < pool.n_shared; i++) {
+        if (sb_writer_close(pool.shared[i].w) < 0) { ret = 1; }
+        pthread_mutex_destroy(&pool.shared[i].lock);
+    }
+    pthread_mutex_destroy(&pool.lock);
+    free(threads);
+    free(pool.shared);
+    free(pool.out);
+    *n_reads = pool.n_reads;
+
+    return ret;
+}
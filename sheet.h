@@ -0,0 +1,58 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2022-2023 Jacob Morrison <jacob.morrison@vai.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef SHEET_H
+#define SHEET_H
+
+#include <stdint.h>
+
+#include "synthbar.h"
+
+// One row of a sample sheet
+typedef struct {
+    char    *infn;    /* input FASTQ */
+    char    *barcode; /* barcode added to every read of the input */
+    char    *outfn;   /* output file */
+    int32_t  line;    /* line of the sample sheet the row came from */
+} sb_sample_t;
+
+// Inputs, barcodes, and outputs from a sample sheet
+typedef struct {
+    int32_t      n;       /* number of samples */
+    sb_sample_t *samples; /* samples in the order listed */
+    char        *text;    /* contents of the sheet, sample fields point into it */
+} sb_sheet_t;
+
+// Read a tab-separated sample sheet with one sample per line: input FASTQ, barcode, and (optionally) output file.
+// Samples without an output file are written to default_outfn. Empty lines and lines starting with '#' are skipped
+// Returns NULL if the sheet could not be read or has an invalid line
+sb_sheet_t *sb_sheet_read(const char *fn, const char *default_outfn);
+void sb_sheet_destroy(sb_sheet_t *s);
+
+// Rewrite every sample, conf->n_threads samples at a time, each with its own barcode. Buffers are reused from one
+// sample to the next, and samples sharing an output file are written into it as their batches finish, so the
+// barcodes keep the samples apart
+// Returns 0 on success, 1 if any sample failed; n_reads is set to the number of reads processed
+int sb_sheet_run(const sb_conf_t *conf, const sb_sheet_t *s, uint64_t *n_reads);
+
+#endif /* SHEET_H */
@@ -0,0 +1,163 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2022-2023 Jacob Morrison <jacob.morrison@vai.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sys/resource.h>
+
+#include "stats.h"
+
+struct sb_progress_s {
+    const sb_stats_t *st;       /* counters being reported */
+    double            interval; /* seconds between progress lines */
+    double            start;    /* time the thread was started */
+    int32_t           stop;     /* set when the run is finished */
+    pthread_mutex_t   lock;     /* guards stop */
+    pthread_cond_t    cond;     /* signaled when stop is set */
+    pthread_t         thread;
+};
+
+void sb_stats_snapshot(const sb_stats_t *st, sb_stats_t *out) {
+    out->n_records    = __atomic_load_n(&st->n_records,    __ATOMIC_RELAXED);
+    out->n_reads      = __atomic_load_n(&st->n_reads,      __ATOMIC_RELAXED);
+    out->in_bytes     = __atomic_load_n(&st->in_bytes,     __ATOMIC_RELAXED);
+    out->out_bytes    = __atomic_load_n(&st->out_bytes,    __ATOMIC_RELAXED);
+    out->inflate_ns   = __atomic_load_n(&st->inflate_ns,   __ATOMIC_RELAXED);
+    out->read_wait_ns = __atomic_load_n(&st->read_wait_ns, __ATOMIC_RELAXED);
+    out->parse_ns     = __atomic_load_n(&st->parse_ns,     __ATOMIC_RELAXED);
+    out->format_ns    = __atomic_load_n(&st->format_ns,    __ATOMIC_RELAXED);
+    out->compress_ns  = __atomic_load_n(&st->compress_ns,  __ATOMIC_RELAXED);
+    out->write_ns     = __atomic_load_n(&st->write_ns,     __ATOMIC_RELAXED);
+}
+
+uint64_t sb_stats_peak_rss() {
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) < 0) { return 0; }
+
+    return (uint64_t)ru.ru_maxrss << 10; /* reported in kilobytes on Linux */
+}
+
+int sb_stats_write_json(const sb_stats_t *st, const char *fn, double wall, int32_t n_threads) {
+    FILE *fp = fopen(fn, "w");
+    if (!fp) {
+        fprintf(stderr, "Could not open stats file: %s\n", fn);
+        return -1;
+    }
+
+    sb_stats_t s;
+    sb_stats_snapshot(st, &s);
+
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"version\": \"%s\",\n", SB_VERSION);
+    fprintf(fp, "  \"threads\": %i,\n", n_threads);
+    fprintf(fp, "  \"wall_seconds\": %.6f,\n", wall);
+    fprintf(fp, "  \"reads\": %" PRIu64 ",\n", s.n_reads);
+    fprintf(fp, "  \"reads_per_second\": %.1f,\n", wall > 0 ? s.n_reads / wall : 0.0);
+    fprintf(fp, "  \"peak_rss_bytes\": %" PRIu64 ",\n", sb_stats_peak_rss());
+    fprintf(fp, "  \"input\": {\n");
+    fprintf(fp, "    \"records\": %" PRIu64 ",\n", s.n_records);
+    fprintf(fp, "    \"bytes\": %" PRIu64 ",\n", s.in_bytes);
+    fprintf(fp, "    \"inflate_seconds\": %.6f,\n", s.inflate_ns * 1e-9);
+    fprintf(fp, "    \"read_wait_seconds\": %.6f,\n", s.read_wait_ns * 1e-9);
+    fprintf(fp, "    \"parse_seconds\": %.6f\n", s.parse_ns * 1e-9);
+    fprintf(fp, "  },\n");
+    fprintf(fp, "  \"output\": {\n");
+    fprintf(fp, "    \"bytes\": %" PRIu64 ",\n", s.out_bytes);
+    fprintf(fp, "    \"format_seconds\": %.6f,\n", s.format_ns * 1e-9);
+    fprintf(fp, "    \"compress_seconds\": %.6f,\n", s.compress_ns * 1e-9);
+    fprintf(fp, "    \"write_seconds\": %.6f\n", s.write_ns * 1e-9);
+    fprintf(fp, "  }\n");
+    fprintf(fp, "}\n");
+
+    if (ferror(fp) | fclose(fp)) {
+        fprintf(stderr, "Error writing stats file: %s\n", fn);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void *progress_thread(void *data) {
+    sb_progress_t *p    = (sb_progress_t *)data;
+    sb_stats_t     last = {0};
+    double         t    = p->start;
+
+    pthread_mutex_lock(&p->lock);
+    while (!p->stop) {
+        // Wake at fixed multiples of the interval so the lines don't drift
+        double          next = t + p->interval;
+        struct timespec ts;
+        ts.tv_sec  = (time_t)next;
+        ts.tv_nsec = (long)((next - (double)ts.tv_sec) * 1e9);
+        pthread_cond_timedwait(&p->cond, &p->lock, &ts);
+        if (p->stop || get_current_time() < next) { continue; }
+        t = next;
+
+        sb_stats_t s;
+        sb_stats_snapshot(p->st, &s);
+        double elapsed = t - p->start;
+        fprintf(stderr, "[synthbar:progress] %" PRIu64 " reads in %.1f seconds, %.0f reads/s (%.0f reads/s overall), "
+                "%.1f MB/s in, %.1f MB/s out\n", s.n_reads, elapsed, (s.n_reads - last.n_reads) / p->interval,
+                s.n_reads / elapsed, (s.in_bytes - last.in_bytes) / p->interval / 1e6,
+                (s.out_bytes - last.out_bytes) / p->interval / 1e6);
+        last = s;
+    }
+    pthread_mutex_unlock(&p->lock);
+
+    return NULL;
+}
+
+sb_progress_t *sb_progress_start(const sb_stats_t *st, double interval) {
+    sb_progress_t *p = (sb_progress_t *)calloc(1, sizeof(sb_progress_t));
+    if (!p) { return NULL; }
+
+    p->st       = st;
+    p->interval = interval;
+    p->start    = get_current_time();
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->cond, NULL);
+    if (pthread_create(&p->thread, NULL, progress_thread, p) != 0) {
+        pthread_mutex_destroy(&p->lock);
+        pthread_cond_destroy(&p->cond);
+        free(p);
+        return NULL;
+    }
+
+    return p;
+}
+
+void sb_progress_stop(sb_progress_t *p) {
+    if (!p) { return; }
+
+    pthread_mutex_lock(&p->lock);
+    p->stop = 1;
+    pthread_cond_signal(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+    pthread_join(p->thread, NULL);
+
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->cond);
+    free(p);
+}
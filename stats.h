@@ -0,0 +1,78 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2022-2023 Jacob Morrison <jacob.morrison@vai.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "synthbar.h"
+
+// Counters and timers for each stage of a run. Stages on different threads add to them with relaxed atomics (once per
+// batch or chunk, never per read), so the progress thread can read them while the run is going
+struct sb_stats_s {
+    uint64_t n_records;    /* records parsed */
+    uint64_t n_reads;      /* reads written (or failed), the reads reported at the end of the run */
+    uint64_t in_bytes;     /* decompressed input bytes parsed */
+    uint64_t out_bytes;    /* bytes written to output files */
+    uint64_t inflate_ns;   /* time decompressing (or reading streamed) input, summed over decompression threads */
+    uint64_t read_wait_ns; /* time the parser waited on input (includes inflating without decompression threads) */
+    uint64_t parse_ns;     /* time parsing records, not counting read_wait_ns */
+    uint64_t format_ns;    /* time rewriting reads, summed over worker threads */
+    uint64_t compress_ns;  /* time compressing output, summed over worker threads */
+    uint64_t write_ns;     /* time blocked writing output */
+};
+
+// Add v to counter f of st, if st is not NULL
+#define SB_STATS_ADD(st, f, v) do { if (st) { __atomic_fetch_add(&(st)->f, (uint64_t)(v), __ATOMIC_RELAXED); } } while (0)
+
+// Returns monotonic time in nanoseconds, for timing stages
+static inline uint64_t sb_time_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// Copy every counter of st into out, each read atomically
+void sb_stats_snapshot(const sb_stats_t *st, sb_stats_t *out);
+
+// Returns the peak resident set size of the process in bytes
+uint64_t sb_stats_peak_rss();
+
+// Write the counters, wall time, and peak RSS of a finished run to fn as a JSON object
+// Returns 0 on success, -1 if the file could not be written
+int sb_stats_write_json(const sb_stats_t *st, const char *fn, double wall, int32_t n_threads);
+
+// Thread printing a progress line to stderr every interval seconds
+typedef struct sb_progress_s sb_progress_t;
+
+// Start reporting progress of st
+// Returns NULL if the thread could not be started
+sb_progress_t *sb_progress_start(const sb_stats_t *st, double interval);
+
+// Stop the progress thread, waiting for it to finish
+void sb_progress_stop(sb_progress_t *p);
+
+#endif /* STATS_H */
@@ -0,0 +1,126 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2022-2023 Jacob Morrison <jacob.morrison@vai.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+#include "structure.h"
+
+// Add a segment of kind k to the pieces of st, merging it into the last piece if the previous segment had the same
+// kind. len is 0 and var set for the variable-length segment
+// Returns 0 on success, -1 if there are too many pieces
+static int add_segment(sb_structure_t *st, char k, char prev, size_t pos, size_t len, int var, int after_var) {
+    sb_piece_t *pc;
+    int32_t    *n;
+    switch (k) {
+        case 'M': pc = st->umi;  n = &st->n_umi;  break;
+        case 'T': pc = st->tmpl; n = &st->n_tmpl; break;
+        default: return 0;
+    }
+
+    if (k == prev) {
+        pc[*n-1].len  += len;
+        pc[*n-1].grow |= (size_t)var;
+        return 0;
+    }
+    if (*n == SB_STRUCT_MAX_SEGS) { return -1; }
+
+    pc[*n].off   = pos;
+    pc[*n].len   = len;
+    pc[*n].shift = (size_t)(after_var && !var);
+    pc[*n].grow  = (size_t)var;
+    (*n)++;
+
+    return 0;
+}
+
+int sb_structure_parse(sb_structure_t *st, const char *s) {
+    memset(st, 0, sizeof(sb_structure_t));
+    st->text = s;
+
+    // Fixed-length segments are laid out from the start of the read, those after the '+' are moved along by the
+    // extra bases of each read
+    const char *p      = s;
+    size_t      pos    = 0;
+    int         var    = 0;
+    int32_t     n_segs = 0;
+    char        prev   = '\0';
+    while (*p) {
+        size_t len    = 0;
+        int    is_var = *p == '+';
+        if (is_var) {
+            p++;
+        } else if (isdigit((unsigned char)*p)) {
+            char *end;
+            long  l = strtol(p, &end, 10);
+            if (l <= 0 || l > 65535) {
+                fprintf(stderr, "Read structure segment lengths must be between 1 and 65535: %s\n", s);
+                return -1;
+            }
+            len = (size_t)l;
+            p   = end;
+        } else {
+            fprintf(stderr, "Read structure segments must start with a length or '+': %s\n", s);
+            return -1;
+        }
+
+        char k = *p++;
+        if (k != 'M' && k != 'S' && k != 'T') {
+            fprintf(stderr, "Read structure segments must be M (UMI), S (skip), or T (template): %s\n", s);
+            return -1;
+        }
+        if (is_var && (var || k == 'M')) {
+            fprintf(stderr, "Read structure can have one '+' segment, which must be S or T: %s\n", s);
+            return -1;
+        }
+        if (++n_segs > SB_STRUCT_MAX_SEGS || add_segment(st, k, prev, pos, len, is_var, var) < 0) {
+            fprintf(stderr, "Read structure has more than %i segments: %s\n", SB_STRUCT_MAX_SEGS, s);
+            return -1;
+        }
+
+        var  |= is_var;
+        prev  = k;
+        pos  += len;
+        if (k == 'M') { st->umi_len += len; }
+        if (k == 'T') {
+            st->tmpl_len  += len;
+            st->tmpl_grow |= (size_t)is_var;
+        }
+    }
+    if (n_segs == 0) {
+        fprintf(stderr, "Read structure is empty\n");
+        return -1;
+    }
+    st->min_len = pos;
+
+    // UMI (if any) at the start of the read, then skipped bases, then template to the end of the read: the same
+    // layout as -u and -l with -r, which has the fastest rewriting functions
+    const sb_piece_t *u = st->umi;
+    const sb_piece_t *t = st->tmpl;
+    st->simple = st->n_umi <= 1 && (st->n_umi == 0 || u->off == 0) && st->n_tmpl == 1 && t->grow && !t->shift &&
+            t->off + t->len == pos;
+    st->link_start = st->simple ? t->off : 0;
+
+    return 0;
+}
@@ -0,0 +1,79 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2022-2023 Jacob Morrison <jacob.morrison@vai.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef STRUCTURE_H
+#define STRUCTURE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "synthbar.h"
+
+#define SB_STRUCT_MAX_SEGS 16 /* most segments a read structure can have */
+
+// Bases copied from a read. extra is the number of bases the read has beyond the fixed-length segments, which all
+// go to the variable-length ('+') segment, so the piece starts at off + shift*extra and is len + grow*extra long
+typedef struct {
+    size_t off;   /* offset of the first base, not counting the variable-length segment */
+    size_t len;   /* number of bases in the fixed-length segments of the piece */
+    size_t shift; /* piece comes after the variable-length segment (1) or not (0) */
+    size_t grow;  /* piece includes the variable-length segment (1) or not (0) */
+} sb_piece_t;
+
+// Read structure compiled into the pieces of each read making up the UMI and the template, in read order.
+// Neighbouring segments of the same kind are merged into one piece
+struct sb_structure_s {
+    const char *text;                     /* read structure as given */
+    int32_t     n_umi;                    /* number of UMI pieces */
+    int32_t     n_tmpl;                   /* number of template pieces */
+    sb_piece_t  umi[SB_STRUCT_MAX_SEGS];  /* UMI pieces, always fixed-length */
+    sb_piece_t  tmpl[SB_STRUCT_MAX_SEGS]; /* template pieces */
+    size_t      umi_len;                  /* number of UMI bases */
+    size_t      tmpl_len;                 /* number of template bases in fixed-length segments */
+    size_t      tmpl_grow;                /* template includes the variable-length segment (1) or not (0) */
+    size_t      min_len;                  /* number of bases in fixed-length segments, the shortest read */
+    int32_t     simple;                   /* UMI, skipped bases, then template to the end of the read */
+    size_t      link_start;               /* offset of the template with a simple structure */
+};
+
+// Parse a read structure of segments made up of a length (or '+' for the rest of the read) and a kind: M for UMI,
+// S for skipped, and T for template bases, e.g. 8M6S+T or 3S8M+T. Bases past the end of a structure without '+'
+// are skipped. s must outlive st
+// Returns 0 on success, -1 if s is not a valid read structure
+int sb_structure_parse(sb_structure_t *st, const char *s);
+
+// Copy the pieces of a read's sequence (or quality) s, which has extra bases beyond the fixed-length segments
+// Returns the new end of p
+static inline char *sb_put_pieces(char *p, const sb_piece_t *pc, int32_t n, const char *s, size_t extra) {
+    int32_t i;
+    for (i = 0; i < n; i++) {
+        size_t l = pc[i].len + pc[i].grow*extra;
+        memcpy(p, s + pc[i].off + pc[i].shift*extra, l);
+        p += l;
+    }
+
+    return p;
+}
+
+#endif /* STRUCTURE_H */
@@ -22,51 +22,44 @@
  * SOFTWARE.
  */
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <getopt.h>
-#include <sys/time.h>
-#include <zlib.h>
-
-#include "kstring.h"
-#include "kseq.h"
-KSEQ_INIT(gzFile, gzread)
-
-#define SB_VERSION "1.0.0" /* synthbar version */
-#define N_EXTRA_CHARS 7    /* 4 newlines + 1 space + 1 separator + 1 null-terminator */
-
-// What the function name says!
-// Returns time in seconds
-static inline double get_current_time() {
-    struct timeval  tp;
-    struct timezone tzp;
-
-    gettimeofday(&tp, &tzp);
-
-    return tp.tv_sec + 1e-6*tp.tv_usec;
-}
+#include <signal.h>
+
+#include "synthbar.h"
+#include "libsynthbar.h"
+#include "reader.h"
+#include "writer.h"
+#include "pipeline.h"
+#include "decomp.h"
+#include "sheet.h"
+#include "demux.h"
+#include "stats.h"
+#include "shard.h"
+#include "structure.h"
+#include "linker.h"
+#include "umistats.h"
+#include "trim.h"
+#include "uring.h"
+
+// Parse a size in bytes with an optional K, M, or G suffix
+// Returns -1 if the size is not valid
+static int64_t parse_size(const char *str) {
+    char    *end;
+    int64_t  size = (int64_t)strtoll(str, &end, 10);
+
+    if (end == str || size < 0) { return -1; }
+    switch (*end) {
+        case 'k': case 'K': size <<= 10; end++; break;
+        case 'm': case 'M': size <<= 20; end++; break;
+        case 'g': case 'G': size <<= 30; end++; break;
+        default: break;
+    }
 
-// Configuration variables
-typedef struct {
-    char     *outfn;         /* name of output file */
-    char     *barcode;       /* barcode to add to each read */
-    uint8_t   umi_first;     /* print the UMI before the barcode in each read */
-    uint8_t   remove_linker; /* remove linker (1) or not (0) */
-    int32_t   linker_length; /* number of bases in linker */
-    int32_t   umi_length;    /* number of bases in UMI */
-} sb_conf_t;
-
-// Initialize config variables
-sb_conf_t init_sb_conf() {
-    sb_conf_t conf = {0};
-
-    conf.outfn         = (char *)"-";
-    conf.barcode       = (char *)"CATATAC";
-    conf.umi_first     = 0;
-    conf.remove_linker = 0;
-    conf.linker_length = 6;
-    conf.umi_length    = 8;
-
-    return conf;
+    return *end == '\0' ? size : -1;
 }
 
 // Print version of code
@@ -83,40 +76,198 @@ static int usage(sb_conf_t *conf) {
     fprintf(stderr, "\n");
     print_version();
     fprintf(stderr, "\n");
-    fprintf(stderr, "Usage: synthbar [options] <FASTQ with UMIs>\n");
+    fprintf(stderr, "Usage: synthbar [options] <FASTQ with UMIs> [mate FASTQ]\n");
+    fprintf(stderr, "       synthbar [options] --sample-sheet <TSV>\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "Output options:\n");
     fprintf(stderr, "    -o, --output STR           name of output file [stdout]\n");
+    fprintf(stderr, "    -p, --mate-output STR      name of output file for mate reads [required with mate FASTQ]\n");
+    fprintf(stderr, "    -z, --gzip                 write gzip (BGZF) compressed output [off]\n");
+    fprintf(stderr, "        --bam                  write unaligned BAM with the barcode in CB and UMI in UB/RX [off]\n");
+    fprintf(stderr, "        --level INT            compression level (0-9) used with -z [%i]\n", conf->level);
+    fprintf(stderr, "        --output-buffer SIZE   bytes of output buffered between writes (K/M/G suffix allowed) [%zuM]\n",
+            conf->out_bufsize >> 20);
+    fprintf(stderr, "        --shards INT           split output across INT files, each with its own writer thread [off]\n");
+    fprintf(stderr, "        --reads-per-shard INT  split output into files of INT reads each [off]\n");
+    fprintf(stderr, "        --shard-by STR         assign reads to --shards by batch (round-robin) or umi (hash) [batch]\n");
     fprintf(stderr, "Processing Options:\n");
     fprintf(stderr, "    -b, --barcode STR          barcode to prepend to each read [%s]\n", conf->barcode);
     fprintf(stderr, "    -U, --umi-first            add barcode to read after the UMI [off]\n");
     fprintf(stderr, "    -r, --remove-linker        remove linker from read [not removed]\n");
     fprintf(stderr, "    -l, --linker-length INT    length of linker to remove [%i]\n", conf->linker_length);
     fprintf(stderr, "    -u, --umi-length INT       length of UMI before linker [%i]\n", conf->umi_length);
+    fprintf(stderr, "        --read-structure STR   layout of UMI (M), skipped (S), and template (T) bases, e.g. 8M6S+T,\n");
+    fprintf(stderr, "                               in place of -u, -l, and -r [off]\n");
+    fprintf(stderr, "        --linker STR           check each read has this linker after the UMI (with -r) [off]\n");
+    fprintf(stderr, "        --max-mismatch INT     mismatches allowed between read and --linker [1]\n");
+    fprintf(stderr, "        --linker-shift INT     look up to INT (0-2) bases either side for a shifted --linker [0]\n");
+    fprintf(stderr, "        --rejects STR          name of output file for reads failing the --linker check [dropped]\n");
+    fprintf(stderr, "        --trim-qual INT        trim bases below quality INT from the 3' end of the cDNA [off]\n");
+    fprintf(stderr, "        --adapter STR          trim this 3' adapter (or its start at the end of a read) from the cDNA [off]\n");
+    fprintf(stderr, "        --trim-polya           trim a 3' poly-A tail from the cDNA [off]\n");
+    fprintf(stderr, "        --min-length INT       drop reads with fewer than INT cDNA bases left after trimming [0]\n");
+    fprintf(stderr, "        --check-names          check read names match between mates [off]\n");
+    fprintf(stderr, "        --sample-sheet STR     TSV of input FASTQ, barcode, and output file to process together\n");
+    fprintf(stderr, "        --index-map STR        TSV of index and barcode, take each read's barcode from its index\n");
+    fprintf(stderr, "        --index-mismatch       allow one mismatch between read and --index-map index [off]\n");
+    fprintf(stderr, "        --unmatched STR        name of output file for reads matching no index [required with\n");
+    fprintf(stderr, "                               --index-map]\n");
+    fprintf(stderr, "Performance Options:\n");
+    fprintf(stderr, "    -@, --threads INT          number of processing threads [%i]\n", conf->n_threads);
+    fprintf(stderr, "        --inflate STR          library used to decompress input [%s]\n", sb_decomp_name(conf->inflate));
+    fprintf(stderr, "                               built with: auto");
+    int i;
+    for (i = 0; i < SB_INFLATE_N; i++) {
+        if (sb_decomp_available(i)) { fprintf(stderr, ", %s", sb_decomp_name(i)); }
+    }
+    fprintf(stderr, "\n");
+    fprintf(stderr, "        --io STR               read input and write output with sync, uring (io_uring), or splice (vmsplice to a pipe) calls [%s]\n",
+            sb_io_name(conf->io));
+    fprintf(stderr, "        --input-buffer SIZE    bytes of gzip or piped input read at once (K/M/G suffix allowed) [%zuK]\n",
+            conf->in_bufsize >> 10);
+    fprintf(stderr, "        --huge-pages           back read and output buffers with huge pages where available [off]\n");
+    fprintf(stderr, "        --progress SECS        print a progress line every SECS seconds [off]\n");
+    fprintf(stderr, "        --stats-json STR       write per-stage counters and timers to a JSON file at exit\n");
+    fprintf(stderr, "        --umi-stats STR        write UMI counts, top UMIs, and base composition to a JSON file at exit\n");
+    fprintf(stderr, "        --umi-top INT          number of most frequent UMIs in --umi-stats [%i]\n", SB_UMI_TOP);
     fprintf(stderr, "    -h, --help                 print usage and exit\n");
     fprintf(stderr, "        --version              print version and exit\n");
     fprintf(stderr, "\n");
-    fprintf(stderr, "Note 1: Input FASTQ can be gzip compressed or uncompressed\n");
+    fprintf(stderr, "Note 1: Input FASTQ can be gzip compressed or uncompressed, - reads it from stdin\n");
+    fprintf(stderr, "Note 2: With a mate FASTQ, its reads are copied unchanged to the mate output\n");
+    fprintf(stderr, "Note 3: With --sample-sheet, -@ samples are processed at once and samples without an output\n");
+    fprintf(stderr, "        file (or naming the same file) are written together, -o is the default output\n");
+    fprintf(stderr, "Note 4: With --index-map, the index is the last field of the read comment (1:N:0:INDEX), -b is\n");
+    fprintf(stderr, "        not used, and reads matching no index are copied unchanged to --unmatched\n");
+    fprintf(stderr, "Note 5: Shards are named after -o (and -p) with the shard number before the extension, e.g.\n");
+    fprintf(stderr, "        out.000.fastq.gz, out.001.fastq.gz, ...\n");
+    fprintf(stderr, "Note 6: With --bam, the UMI and linker are always removed from the sequence (-r), and\n");
+    fprintf(stderr, "        --unmatched reads are written as compressed FASTQ\n");
+    fprintf(stderr, "Note 7: With --read-structure, M segments are joined into the UMI and T segments into the rest of\n");
+    fprintf(stderr, "        the read, + is the rest of the read, and bases past the end of a structure without + are dropped\n");
+    fprintf(stderr, "Note 8: The cDNA is what follows the UMI (and linker with -r) or the template of --read-structure,\n");
+    fprintf(stderr, "        trimmed in the order --trim-qual, --adapter, then --trim-polya\n");
     fprintf(stderr, "\n");
 
     return 0;
 }
 
+// Print the outcomes of the linker check
+static void print_linker(const char *func, const sb_linker_t *lk) {
+    const uint64_t *n = lk->counts;
+    fprintf(stderr, "[synthbar:%s] %" PRIu64 " reads had the linker where expected, %" PRIu64 " shifted, %" PRIu64
+            " rejected\n", func, n[SB_LINKER_PASS], n[SB_LINKER_SHIFTED], n[SB_LINKER_REJECTED]);
+}
+
+// Print the outcomes of trimming
+static void print_trim(const char *func, const sb_trim_t *tr) {
+    const uint64_t *n = tr->counts;
+    fprintf(stderr, "[synthbar:%s] %" PRIu64 " reads quality trimmed, %" PRIu64 " with an adapter, %" PRIu64 " with a "
+            "poly-A tail, %" PRIu64 " too short, %" PRIu64 " bases trimmed\n", func, n[SB_TRIM_QUAL],
+            n[SB_TRIM_ADAPTER], n[SB_TRIM_POLYA], n[SB_TRIM_SHORT], tr->n_bases);
+}
+
+// Print a summary of the UMI statistics, write them to fn with the top most frequent UMIs, and free them
+// Returns 0 on success, 1 if the statistics could not be written
+static int finish_umi_stats(const char *func, sb_umi_stats_t *us, const char *fn, int32_t top) {
+    fprintf(stderr, "[synthbar:%s] %" PRIu64 " UMIs, %" PRIu64 " distinct%s, %" PRIu64 " with an N\n", func,
+            us->n_umis, sb_umi_stats_distinct(us), us->hll ? " (estimated)" : "", us->n_with_n);
+    int ret = sb_umi_stats_write_json(us, fn, top) < 0;
+    sb_umi_stats_destroy(us);
+
+    return ret;
+}
+
+// Process every sample in a sample sheet, reporting progress every progress seconds (if > 0) and writing the run's
+// stats to statsfn and UMI statistics to umifn (if not NULL)
+// Returns 0 on success, 1 on error
+static int run_sample_sheet(sb_conf_t *conf, const char *fn, double progress, const char *statsfn, const char *umifn,
+        int32_t umi_top) {
+    sb_sheet_t *sheet = sb_sheet_read(fn, conf->outfn);
+    if (!sheet) {
+        sb_umi_stats_destroy(conf->umi_stats);
+        return 1;
+    }
+
+    // Report a closed output pipe as a write error rather than being killed by SIGPIPE
+    signal(SIGPIPE, SIG_IGN);
+
+    uint64_t read_count = 0;
+
+    sb_progress_t *prog = progress > 0 ? sb_progress_start(conf->stats, progress) : NULL;
+    double t1 = get_current_time();
+    int ret_code = sb_sheet_run(conf, sheet, &read_count);
+    double t2 = get_current_time();
+    sb_progress_stop(prog);
+
+    fprintf(stderr, "[synthbar:%s] %" PRIu64 " reads from %i samples processed in %.3f seconds (wall time)\n",
+            __func__, read_count, sheet->n, t2-t1);
+    if (conf->linker) { print_linker(__func__, conf->linker); }
+    if (conf->trim) { print_trim(__func__, conf->trim); }
+    if (statsfn && sb_stats_write_json(conf->stats, statsfn, t2-t1, conf->n_threads) < 0) { ret_code = 1; }
+    if (umifn && finish_umi_stats(__func__, conf->umi_stats, umifn, umi_top)) { ret_code = 1; }
+    sb_sheet_destroy(sheet);
+
+    return ret_code;
+}
+
 int main(int argc, char *argv[]) {
     // Init variables
-    sb_conf_t conf = init_sb_conf();
+    sb_conf_t conf = sb_conf_init();
+    char *sheetfn = NULL, *indexfn = NULL, *missfn = NULL, *statsfn = NULL, *structstr = NULL, *linkerseq = NULL;
+    char *rejectfn = NULL, *umifn = NULL, *adapter = NULL;
+    int index_mismatch = 0, layout_opts = 0, link_len_opt = 0, max_mismatch = -1, linker_shift = -1, polya = 0;
+    int32_t umi_top = SB_UMI_TOP, trim_qual = 0, min_len = 0;
+    sb_structure_t structure;
+    sb_linker_t linker;
+    sb_trim_t trim;
+    double progress = 0;
+    sb_stats_t stats = {0};
+    conf.stats = &stats;
+    int64_t size;
     int c;
 
     // Command line arguments
     static const struct option loptions[] = {
-        {"output"       , required_argument, NULL, 'o'},
-        {"barcode"      , required_argument, NULL, 'b'},
-        {"umi-first"    , no_argument      , NULL, 'U'},
-        {"remove-linker", no_argument      , NULL, 'r'},
-        {"linker-length", required_argument, NULL, 'l'},
-        {"umi-length"   , required_argument, NULL, 'u'},
-        {"help"         , no_argument      , NULL, 'h'},
-        {"version"      , no_argument      , NULL,  1 },
+        {"output"         , required_argument, NULL, 'o'},
+        {"mate-output"    , required_argument, NULL, 'p'},
+        {"gzip"           , no_argument      , NULL, 'z'},
+        {"barcode"        , required_argument, NULL, 'b'},
+        {"umi-first"      , no_argument      , NULL, 'U'},
+        {"remove-linker"  , no_argument      , NULL, 'r'},
+        {"linker-length"  , required_argument, NULL, 'l'},
+        {"umi-length"     , required_argument, NULL, 'u'},
+        {"threads"        , required_argument, NULL, '@'},
+        {"help"           , no_argument      , NULL, 'h'},
+        {"version"        , no_argument      , NULL,  1 },
+        {"output-buffer"  , required_argument, NULL,  2 },
+        {"level"          , required_argument, NULL,  3 },
+        {"inflate"        , required_argument, NULL,  4 },
+        {"check-names"    , no_argument      , NULL,  5 },
+        {"sample-sheet"   , required_argument, NULL,  6 },
+        {"index-map"      , required_argument, NULL,  7 },
+        {"index-mismatch" , no_argument      , NULL,  8 },
+        {"unmatched"      , required_argument, NULL,  9 },
+        {"progress"       , required_argument, NULL, 10 },
+        {"stats-json"     , required_argument, NULL, 11 },
+        {"shards"         , required_argument, NULL, 12 },
+        {"reads-per-shard", required_argument, NULL, 13 },
+        {"shard-by"       , required_argument, NULL, 14 },
+        {"bam"            , no_argument      , NULL, 15 },
+        {"read-structure" , required_argument, NULL, 16 },
+        {"linker"         , required_argument, NULL, 17 },
+        {"max-mismatch"   , required_argument, NULL, 18 },
+        {"linker-shift"   , required_argument, NULL, 19 },
+        {"rejects"        , required_argument, NULL, 20 },
+        {"umi-stats"      , required_argument, NULL, 21 },
+        {"umi-top"        , required_argument, NULL, 22 },
+        {"trim-qual"      , required_argument, NULL, 23 },
+        {"adapter"        , required_argument, NULL, 24 },
+        {"trim-polya"     , no_argument      , NULL, 25 },
+        {"min-length"     , required_argument, NULL, 26 },
+        {"io"             , required_argument, NULL, 27 },
+        {"input-buffer"   , required_argument, NULL, 28 },
+        {"huge-pages"     , no_argument      , NULL, 29 },
         {NULL, 0, NULL, 0}
     };
 
@@ -126,11 +277,17 @@ int main(int argc, char *argv[]) {
         return 0;
     }
 
-    while ((c = getopt_long(argc, argv, "b:l:o:u:Uhrz", loptions, NULL)) >= 0) {
+    while ((c = getopt_long(argc, argv, "b:l:o:p:u:@:Uhrz", loptions, NULL)) >= 0) {
         switch (c) {
             case 'o':
                 conf.outfn = optarg;
                 break;
+            case 'p':
+                conf.mate_outfn = optarg;
+                break;
+            case 'z':
+                conf.compress = 1;
+                break;
             case 'b':
                 conf.barcode = optarg;
                 break;
@@ -139,12 +296,18 @@ int main(int argc, char *argv[]) {
                 break;
             case 'r':
                 conf.remove_linker = 1;
+                layout_opts = 1;
                 break;
             case 'l':
                 conf.linker_length = (int32_t)atoi(optarg);
+                layout_opts = link_len_opt = 1;
                 break;
             case 'u':
                 conf.umi_length = (int32_t)atoi(optarg);
+                layout_opts = 1;
+                break;
+            case '@':
+                conf.n_threads = (int32_t)atoi(optarg);
                 break;
             case 'h':
                 usage(&conf);
@@ -152,6 +315,156 @@ int main(int argc, char *argv[]) {
             case 1:
                 print_version();
                 return 0;
+            case 2:
+                size = parse_size(optarg);
+                if (size <= 0) {
+                    fprintf(stderr, "Invalid output buffer size: %s\n", optarg);
+                    return 1;
+                }
+                conf.out_bufsize = (size_t)size;
+                break;
+            case 3:
+                conf.level = (int32_t)atoi(optarg);
+                break;
+            case 4:
+                conf.inflate = (int32_t)sb_decomp_parse(optarg);
+                if (conf.inflate < SB_INFLATE_AUTO) {
+                    fprintf(stderr, "Unknown inflate library: %s\n", optarg);
+                    return 1;
+                }
+                if (!sb_decomp_available(conf.inflate)) {
+                    fprintf(stderr, "synthbar was not built with %s (see Makefile)\n", optarg);
+                    return 1;
+                }
+                break;
+            case 5:
+                conf.check_names = 1;
+                break;
+            case 6:
+                sheetfn = optarg;
+                break;
+            case 7:
+                indexfn = optarg;
+                break;
+            case 8:
+                index_mismatch = 1;
+                break;
+            case 9:
+                missfn = optarg;
+                break;
+            case 10:
+                progress = atof(optarg);
+                if (progress <= 0) {
+                    fprintf(stderr, "Progress interval (%s) must be > 0 seconds\n", optarg);
+                    return 1;
+                }
+                break;
+            case 11:
+                statsfn = optarg;
+                break;
+            case 12:
+                conf.n_shards = (int32_t)atoi(optarg);
+                if (conf.n_shards < 1) {
+                    fprintf(stderr, "Number of shards (%s) must be >= 1\n", optarg);
+                    return 1;
+                }
+                break;
+            case 13:
+                size = (int64_t)strtoll(optarg, NULL, 10);
+                if (size < 1) {
+                    fprintf(stderr, "Reads per shard (%s) must be >= 1\n", optarg);
+                    return 1;
+                }
+                conf.reads_per_shard = (uint64_t)size;
+                break;
+            case 14:
+                if (strcmp(optarg, "umi") == 0) {
+                    conf.shard_umi = 1;
+                } else if (strcmp(optarg, "batch") == 0) {
+                    conf.shard_umi = 0;
+                } else {
+                    fprintf(stderr, "Unknown shard assignment (batch or umi): %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 15:
+                conf.bam = 1;
+                break;
+            case 16:
+                structstr = optarg;
+                break;
+            case 17:
+                linkerseq = optarg;
+                break;
+            case 18:
+                max_mismatch = (int)atoi(optarg);
+                if (max_mismatch < 0) {
+                    fprintf(stderr, "Linker mismatches (%s) must be >= 0\n", optarg);
+                    return 1;
+                }
+                break;
+            case 19:
+                linker_shift = (int)atoi(optarg);
+                if (linker_shift < 0 || linker_shift > SB_LINKER_MAX_SHIFT) {
+                    fprintf(stderr, "Linker shift (%s) must be between 0 and %i\n", optarg, SB_LINKER_MAX_SHIFT);
+                    return 1;
+                }
+                break;
+            case 20:
+                rejectfn = optarg;
+                break;
+            case 21:
+                umifn = optarg;
+                break;
+            case 22:
+                umi_top = (int32_t)atoi(optarg);
+                if (umi_top < 0) {
+                    fprintf(stderr, "Number of top UMIs (%s) must be >= 0\n", optarg);
+                    return 1;
+                }
+                break;
+            case 23:
+                trim_qual = (int32_t)atoi(optarg);
+                if (trim_qual < 1 || trim_qual > 93) {
+                    fprintf(stderr, "Trimming quality (%s) must be between 1 and 93\n", optarg);
+                    return 1;
+                }
+                break;
+            case 24:
+                adapter = optarg;
+                break;
+            case 25:
+                polya = 1;
+                break;
+            case 26:
+                min_len = (int32_t)atoi(optarg);
+                if (min_len < 1) {
+                    fprintf(stderr, "Minimum length (%s) must be >= 1\n", optarg);
+                    return 1;
+                }
+                break;
+            case 27:
+                conf.io = sb_io_parse(optarg);
+                if (conf.io < 0) {
+                    fprintf(stderr, "Unknown I/O method: %s\n", optarg);
+                    return 1;
+                }
+                if (conf.io == SB_IO_URING && !sb_uring_available()) {
+                    fprintf(stderr, "io_uring is not available, using sync I/O\n");
+                    conf.io = SB_IO_SYNC;
+                }
+                break;
+            case 28:
+                size = parse_size(optarg);
+                if (size <= 0 || size > (1 << 30)) {
+                    fprintf(stderr, "Invalid input buffer size (1-1G): %s\n", optarg);
+                    return 1;
+                }
+                conf.in_bufsize = (size_t)size;
+                break;
+            case 29:
+                conf.huge_pages = 1;
+                break;
             default:
                 usage(&conf);
                 return 0;
@@ -160,120 +473,242 @@ int main(int argc, char *argv[]) {
 
     // Check for input file
     char *infn = optind < argc ? argv[optind++] : NULL;
-    if (!infn) {
+    if (sheetfn && infn) {
+        fprintf(stderr, "Input FASTQ can't be given with --sample-sheet\n");
+        return 1;
+    }
+    if (!infn && !sheetfn) {
         usage(&conf);
         fprintf(stderr, "Please provide an input FASTQ\n");
         return 1;
     }
+    char *matefn = optind < argc ? argv[optind++] : NULL;
 
-    // Check linker and UMI lengths
-    if (conf.umi_length < 0 || conf.linker_length < 0) {
-        fprintf(stderr, "Linker (%i) and UMI (%i) lengths must both be >= 0\n", conf.linker_length, conf.umi_length);
+    // Check mate output is given with (and only with) a mate FASTQ
+    if (matefn && !conf.mate_outfn) {
+        fprintf(stderr, "Please provide an output file for mate reads (-p)\n");
         return 1;
     }
-
-    // Init files and handle errors
-    gzFile fh1 = gzopen(infn, "r");
-    if (!fh1) {
-        fprintf(stderr, "Could not open input file: %s\n", infn);
+    if (!matefn && conf.mate_outfn) {
+        fprintf(stderr, "Mate output (-p) given without a mate FASTQ\n");
+        return 1;
+    }
+    if (matefn && strcmp(conf.outfn, "-") == 0 && strcmp(conf.mate_outfn, "-") == 0) {
+        fprintf(stderr, "Output and mate output can't both be stdout\n");
+        return 1;
+    }
+    if (matefn && strcmp(infn, "-") == 0 && strcmp(matefn, "-") == 0) {
+        fprintf(stderr, "Input and mate input can't both be stdin\n");
         return 1;
     }
 
-    FILE *oh1 = strcmp(conf.outfn, "-") == 0 ? stdout : fopen(conf.outfn, "w");
-    if (strcmp(conf.outfn, "-") != 0 && !oh1) {
-        fprintf(stderr, "Could not open output file: %s\n", conf.outfn);
-        gzclose(fh1);
+    // Check demultiplexing options
+    if (indexfn && (sheetfn || matefn)) {
+        fprintf(stderr, "--index-map can't be used with --sample-sheet or a mate FASTQ\n");
+        return 1;
+    }
+    if (!indexfn && (missfn || index_mismatch)) {
+        fprintf(stderr, "--unmatched and --index-mismatch require --index-map\n");
+        return 1;
+    }
+    if (indexfn && !missfn) {
+        fprintf(stderr, "Please provide an output file for unmatched reads (--unmatched)\n");
+        return 1;
+    }
+    if (indexfn && strcmp(conf.outfn, "-") == 0 && strcmp(missfn, "-") == 0) {
+        fprintf(stderr, "Output and unmatched output can't both be stdout\n");
         return 1;
     }
 
-    // Create qual string to add
-    size_t  bc_len   = strlen(conf.barcode);
-    char   *pre_qual = malloc(bc_len + 1);
-    memset(pre_qual, 'I', bc_len);
-    pre_qual[bc_len] = '\0';
+    // Check sharding options
+    int shard = conf.n_shards > 0 || conf.reads_per_shard > 0;
+    if (conf.n_shards > 0 && conf.reads_per_shard > 0) {
+        fprintf(stderr, "--shards and --reads-per-shard can't both be given\n");
+        return 1;
+    }
+    if (conf.shard_umi && conf.n_shards == 0) {
+        fprintf(stderr, "--shard-by umi requires --shards\n");
+        return 1;
+    }
+    if (shard && sheetfn) {
+        fprintf(stderr, "--shards and --reads-per-shard can't be used with --sample-sheet\n");
+        return 1;
+    }
+    if (shard && (strcmp(conf.outfn, "-") == 0 || (matefn && strcmp(conf.mate_outfn, "-") == 0))) {
+        fprintf(stderr, "Sharded output needs output file names (-o and -p), not stdout\n");
+        return 1;
+    }
 
-    // Variable initialization
-    int        ret_code   = 0;
-    kseq_t    *ks1        = kseq_init(fh1);
-    int32_t    u_plus_l   = conf.umi_length + conf.linker_length;
-    int32_t    link_start = conf.remove_linker ? u_plus_l : conf.umi_length;
-    uint32_t   read_count = 0;
-    kstring_t *str        = (kstring_t *)calloc(1, sizeof(kstring_t));
+    // Check BAM output options, BAM is always BGZF compressed
+    if (conf.bam && (matefn || shard || conf.umi_first)) {
+        fprintf(stderr, "--bam can't be used with a mate FASTQ, sharded output, or -U\n");
+        return 1;
+    }
+    if (conf.bam) { conf.compress = 1; }
 
-    // Process reads
-    double t1 = get_current_time();
-    while (kseq_read(ks1) >= 0) {
-        read_count++;
-
-        // Handle error case of too short read, seq and qual should be same length, so only check seq
-        if (conf.remove_linker && ks1->seq.l < u_plus_l) {
-            fprintf(stderr, "Read shorter than UMI and linker lengths provided (%li < %i)\n", ks1->seq.l, u_plus_l);
-            ret_code = 1;
-            goto end;
-        }
+    // Check linker and UMI lengths
+    if (conf.umi_length < 0 || conf.linker_length < 0) {
+        fprintf(stderr, "Linker (%i) and UMI (%i) lengths must both be >= 0\n", conf.linker_length, conf.umi_length);
+        return 1;
+    }
 
-        // Pre-allocate space, or expand space ahead of time to reduce the number of allocations needed
-        size_t str_len = ks1->name.l + ks1->comment.l + ks1->seq.l + ks1->qual.l + (size_t)N_EXTRA_CHARS;
+    // Compile the read structure, which replaces the UMI and linker options
+    if (structstr && layout_opts) {
+        fprintf(stderr, "--read-structure can't be used with -u, -l, or -r\n");
+        return 1;
+    }
+    if (structstr) {
+        if (sb_structure_parse(&structure, structstr) < 0) { return 1; }
+        conf.structure = &structure;
+    }
 
-        if (str_len > str->m) {
-            int err = ks_resize(str, str_len);
-            if (err < 0) {
-                ret_code = 1;
-                fprintf(stderr, "Unable to reallocate sufficient space\n");
-                goto end;
-            }
+    // Check linker options, reads failing the check go to --rejects, or to --unmatched when demultiplexing
+    if (!linkerseq && (max_mismatch >= 0 || linker_shift >= 0 || rejectfn)) {
+        fprintf(stderr, "--max-mismatch, --linker-shift, and --rejects require --linker\n");
+        return 1;
+    }
+    if (rejectfn && (indexfn || matefn || sheetfn)) {
+        fprintf(stderr, "--rejects can't be used with --index-map (see --unmatched), a mate FASTQ, or --sample-sheet\n");
+        return 1;
+    }
+    if (rejectfn && strcmp(conf.outfn, "-") == 0 && strcmp(rejectfn, "-") == 0) {
+        fprintf(stderr, "Output and rejects output can't both be stdout\n");
+        return 1;
+    }
+    if (linkerseq) {
+        if (sb_linker_init(&linker, linkerseq, max_mismatch < 0 ? 1 : max_mismatch, linker_shift < 0 ? 0 : linker_shift,
+                    rejectfn || indexfn) < 0) {
+            return 1;
         }
+        conf.linker = &linker;
 
-        // Read name
-        ksprintf(str, "@%s", ks1->name.s);
-
-        // Read comment (if applicable)
-        if (ks1->comment.l > 0) {
-            ksprintf(str, " %s", ks1->comment.s);
+        // The linker sets the linker length, and must be removed right after the UMI
+        int32_t l = (int32_t)linker.len;
+        if (link_len_opt && conf.linker_length != l) {
+            fprintf(stderr, "Linker length (%i) differs from the length of --linker (%i)\n", conf.linker_length, l);
+            return 1;
+        }
+        conf.linker_length = l;
+        if (conf.structure ? !structure.simple || structure.link_start - structure.umi_len != linker.len
+                           : !conf.remove_linker && !conf.bam) {
+            fprintf(stderr, "--linker needs -r, --bam, or a read structure of UMI, linker (%iS), and template\n", l);
+            return 1;
         }
+        if (rejectfn) { missfn = rejectfn; }
+    }
 
-        // UMI and barcode (seq)
-        if (!conf.umi_first) {
-            ksprintf(str, "\n%s%.*s", conf.barcode, conf.umi_length, ks1->seq.s);
-        } else {
-            ksprintf(str, "\n%.*s%s", conf.umi_length, ks1->seq.s, conf.barcode);
+    // Set up trimming, which needs the cDNA to run to the end of the read
+    if (trim_qual || adapter || polya || min_len) {
+        if (sb_trim_init(&trim, adapter, trim_qual, polya, min_len) < 0) { return 1; }
+        conf.trim = &trim;
+        if (!sb_trim_fits(&conf)) {
+            fprintf(stderr, "Trimming needs a read structure ending with a variable-length template (+T)\n");
+            return 1;
         }
+    }
 
-        // Linker (seq), sequence, and separator
-        ksprintf(str, "%s\n+\n", ks1->seq.s + link_start);
+    // Check number of threads
+    if (conf.n_threads < 1) {
+        fprintf(stderr, "Number of threads (%i) must be >= 1\n", conf.n_threads);
+        return 1;
+    }
 
-        // UMI and barcode (qual)
-        if (!conf.umi_first) {
-            ksprintf(str, "%s%.*s", pre_qual, conf.umi_length, ks1->qual.s);
-        } else {
-            ksprintf(str, "%.*s%s", conf.umi_length, ks1->qual.s, pre_qual);
-        }
+    // Check compression level
+    if (conf.level < 0 || conf.level > 9) {
+        fprintf(stderr, "Compression level (%i) must be between 0 and 9\n", conf.level);
+        return 1;
+    }
 
-        // Linker (qual) and quality
-        ksprintf(str, "%s\n", ks1->qual.s + link_start);
+    // Each worker thread counts UMIs into its own table, merged into conf.umi_stats as it finishes
+    size_t umi_len = conf.structure ? structure.umi_len : (size_t)conf.umi_length;
+    if (umifn && umi_len == 0) {
+        fprintf(stderr, "--umi-stats needs a UMI (-u or M segments in --read-structure)\n");
+        return 1;
+    }
+    if (umifn && (conf.umi_stats = sb_umi_stats_init(umi_len)) == NULL) {
+        fprintf(stderr, "Unable to allocate UMI statistics\n");
+        return 1;
+    }
+
+    if (sheetfn) { return run_sample_sheet(&conf, sheetfn, progress, statsfn, umifn, umi_top); }
 
-        // Print out read
-        fprintf(oh1, "%s", str->s);
+    // Init files and handle errors, anything opened before a failure is closed at cleanup
+    int          ret_code = 1, ran = 0;
+    sb_reader_t *rd  = NULL, *mate_rd = NULL;
+    sb_writer_t *oh1 = NULL, *oh2 = NULL, *oh3 = NULL;
+    sb_shards_t *sh1 = NULL, *sh2 = NULL;
+    if (indexfn && (conf.demux = sb_demux_load(indexfn, index_mismatch)) == NULL) { goto cleanup; }
+    if ((rd = sb_reader_open(infn, conf.in_bufsize, conf.n_threads, conf.inflate, conf.io, conf.stats)) == NULL) {
+        fprintf(stderr, "Could not open input file: %s\n", infn);
+        goto cleanup;
+    }
+    if (matefn && (mate_rd = sb_reader_open(matefn, conf.in_bufsize, conf.n_threads, conf.inflate, conf.io,
+                    conf.stats)) == NULL) {
+        fprintf(stderr, "Could not open mate input file: %s\n", matefn);
+        goto cleanup;
+    }
 
-        // Reset kstring for next read
-        str->s[0] = '\0';
-        str->l = 0;
+    // Sharded output goes to sh1 and sh2 in place of oh1 and oh2
+    if (shard) {
+        if ((sh1 = sb_shards_open(&conf, conf.outfn)) == NULL) { goto cleanup; }
+    } else if ((oh1 = sb_writer_open(conf.outfn, conf.out_bufsize, conf.compress, conf.io, conf.stats)) == NULL) {
+        fprintf(stderr, "Could not open output file: %s\n", conf.outfn);
+        goto cleanup;
+    } else if (conf.bam && sb_writer_bam_header(oh1, conf.level) < 0) {
+        goto cleanup;
     }
 
-    goto end;
+    if (matefn && shard) {
+        if ((sh2 = sb_shards_open(&conf, conf.mate_outfn)) == NULL) { goto cleanup; }
+    } else if (matefn && (oh2 = sb_writer_open(conf.mate_outfn, conf.out_bufsize, conf.compress, conf.io,
+                    conf.stats)) == NULL) {
+        fprintf(stderr, "Could not open mate output file: %s\n", conf.mate_outfn);
+        goto cleanup;
+    }
 
-end:
-    double t2 = get_current_time();
+    if (missfn && (oh3 = sb_writer_open(missfn, conf.out_bufsize, conf.compress, conf.io, conf.stats)) == NULL) {
+        fprintf(stderr, "Could not open %s output file: %s\n", indexfn ? "unmatched" : "rejects", missfn);
+        goto cleanup;
+    }
+
+    // Report a closed output pipe as a write error rather than being killed by SIGPIPE
+    signal(SIGPIPE, SIG_IGN);
 
-    // Clean up
-    free(str->s);
-    free(str);
-    kseq_destroy(ks1);
-    free(pre_qual);
-    if (strcmp(conf.outfn, "-") != 0) { fclose(oh1); }
-    gzclose(fh1);
+    // Process reads
+    uint64_t read_count = 0;
 
-    fprintf(stderr, "[synthbar:%s] %u reads processed in %.3f seconds (wall time)\n", __func__, read_count, t2-t1);
+    sb_progress_t *prog = progress > 0 ? sb_progress_start(&stats, progress) : NULL;
+    double t1 = get_current_time();
+    ret_code = sb_pipeline_run(&conf, rd, mate_rd, oh1, oh2, sh1, sh2, oh3, &read_count);
+    double t2 = get_current_time();
+    sb_progress_stop(prog);
+    ran = 1;
+
+cleanup:
+    if (oh1 && sb_writer_close(oh1) < 0) { ret_code = 1; }
+    if (oh2 && sb_writer_close(oh2) < 0) { ret_code = 1; }
+    if (sb_shards_close(sh1) < 0 || sb_shards_close(sh2) < 0) { ret_code = 1; }
+    if (oh3 && sb_writer_close(oh3) < 0) { ret_code = 1; }
+    sb_reader_close(mate_rd);
+    sb_reader_close(rd);
+    if (!ran) {
+        sb_demux_destroy(conf.demux);
+        sb_umi_stats_destroy(conf.umi_stats);
+        return 1;
+    }
+    if (statsfn && sb_stats_write_json(&stats, statsfn, t2-t1, conf.n_threads) < 0) { ret_code = 1; }
+
+    fprintf(stderr, "[synthbar:%s] %" PRIu64 " %s processed in %.3f seconds (wall time)\n", __func__, read_count,
+            matefn ? "read pairs" : "reads", t2-t1);
+    if (conf.demux) {
+        const uint64_t *n = conf.demux->counts;
+        fprintf(stderr, "[synthbar:%s] %" PRIu64 " reads matched an index exactly, %" PRIu64 " with one mismatch, "
+                "%" PRIu64 " unmatched\n", __func__, n[SB_DEMUX_EXACT], n[SB_DEMUX_MISMATCH], n[SB_DEMUX_UNMATCHED]);
+        sb_demux_destroy(conf.demux);
+    }
+    if (conf.linker) { print_linker(__func__, conf.linker); }
+    if (conf.trim) { print_trim(__func__, &trim); }
+    if (umifn && finish_umi_stats(__func__, conf.umi_stats, umifn, umi_top)) { ret_code = 1; }
 
     return ret_code;
 }
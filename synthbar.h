@@ -0,0 +1,81 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2022-2023 Jacob Morrison <jacob.morrison@vai.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef SYNTHBAR_H
+#define SYNTHBAR_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/time.h>
+
+#define SB_VERSION "1.0.0" /* synthbar version */
+
+typedef struct sb_demux_s sb_demux_t;         /* index to barcode table, see demux.h */
+typedef struct sb_stats_s sb_stats_t;         /* per-stage counters and timers, see stats.h */
+typedef struct sb_structure_s sb_structure_t; /* compiled read structure, see structure.h */
+typedef struct sb_linker_s sb_linker_t;       /* expected linker, see linker.h */
+typedef struct sb_umi_stats_s sb_umi_stats_t; /* UMI complexity statistics, see umistats.h */
+typedef struct sb_trim_s sb_trim_t;           /* 3' trimming of the cDNA, see trim.h */
+
+// Configuration variables
+typedef struct {
+    char           *outfn;           /* name of output file */
+    char           *mate_outfn;      /* name of output file for mate reads (paired input only) */
+    char           *barcode;         /* barcode to add to each read */
+    uint8_t         umi_first;       /* print the UMI before the barcode in each read */
+    uint8_t         remove_linker;   /* remove linker (1) or not (0) */
+    int32_t         linker_length;   /* number of bases in linker */
+    int32_t         umi_length;      /* number of bases in UMI */
+    uint8_t         check_names;     /* check read names match between mates */
+    int32_t         n_threads;       /* number of processing threads */
+    size_t          out_bufsize;     /* number of bytes buffered before writing output */
+    uint8_t         compress;        /* write BGZF compressed output */
+    int32_t         level;           /* compression level */
+    int32_t         inflate;         /* library used to decompress input (SB_INFLATE_*) */
+    int32_t         io;              /* how input and output files are read and written (SB_IO_*) */
+    size_t          in_bufsize;      /* number of bytes of streamed input read at once */
+    uint8_t         huge_pages;      /* back batch input and output buffers with huge pages */
+    sb_demux_t     *demux;           /* barcodes to assign from each read's index, NULL to use barcode for every read */
+    sb_stats_t     *stats;           /* counters and timers of the run, not collected if NULL */
+    int32_t         n_shards;        /* number of output shards, 0 to write a single output file */
+    uint64_t        reads_per_shard; /* reads written to each shard before the next is opened, 0 for n_shards shards */
+    uint8_t         shard_umi;       /* assign reads to shards by a hash of their UMI instead of batches round-robin */
+    uint8_t         bam;             /* write unaligned BAM records with CB and UB tags instead of FASTQ */
+    sb_structure_t *structure;       /* layout of UMI and template in each read, NULL to use UMI and linker lengths */
+    sb_linker_t    *linker;          /* linker to check after the UMI of each read (with -r), NULL to not check */
+    sb_umi_stats_t *umi_stats;       /* UMI complexity statistics of the run, not collected if NULL */
+    sb_trim_t      *trim;            /* trimming of the cDNA after the UMI and linker, NULL to not trim */
+} sb_conf_t;
+
+// What the function name says!
+// Returns time in seconds
+static inline double get_current_time() {
+    struct timeval  tp;
+    struct timezone tzp;
+
+    gettimeofday(&tp, &tzp);
+
+    return tp.tv_sec + 1e-6*tp.tv_usec;
+}
+
+#endif /* SYNTHBAR_H */